@@ -0,0 +1,114 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <unistd.h>
+#include "ccbase/clock.h"
+#ifdef CCB_HAVE_TSC
+#include <cpuid.h>
+#endif
+
+namespace ccb {
+
+namespace {
+
+#ifdef CCB_HAVE_TSC
+uint64_t CalibrateTscMult(unsigned shift) {
+  // measure the TSC rate against CLOCK_MONOTONIC over a short period
+  MonotonicClock mono;
+  uint64_t ns_begin = mono.NowNs();
+  uint64_t tsc_begin = __rdtsc();
+  usleep(20000);
+  uint64_t ns_end = mono.NowNs();
+  uint64_t tsc_end = __rdtsc();
+  return static_cast<uint64_t>(
+      (static_cast<unsigned __int128>(ns_end - ns_begin) << shift) /
+      (tsc_end - tsc_begin));
+}
+#endif
+
+}  // namespace
+
+constexpr unsigned MonotonicClock::kTscShift;
+
+MonotonicClock::MonotonicClock(ClockSource source)
+    : source_(source),
+      clock_id_(source == ClockSource::kMonotonicCoarse ?
+                CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC),
+      tsc_mult_(0) {
+  if (source_ == ClockSource::kTsc) {
+    tsc_mult_ = TscMult();
+    if (tsc_mult_ == 0) {
+      source_ = ClockSource::kMonotonic;
+    }
+  }
+}
+
+uint64_t MonotonicClock::TscMult() {
+#ifdef CCB_HAVE_TSC
+  // calibrate only once for the process
+  static const uint64_t tsc_mult =
+      (IsTscReliable() ? CalibrateTscMult(kTscShift) : 0);
+  return tsc_mult;
+#else
+  return 0;
+#endif
+}
+
+uint64_t MonotonicClock::NowNs(ClockSource source) {
+#ifdef CCB_HAVE_TSC
+  if (source == ClockSource::kTsc) {
+    uint64_t tsc_mult = TscMult();
+    if (tsc_mult) {
+      return static_cast<uint64_t>(
+          (static_cast<unsigned __int128>(__rdtsc()) * tsc_mult) >> kTscShift);
+    }
+  }
+#endif
+  struct timespec ts;
+  if (clock_gettime(source == ClockSource::kMonotonicCoarse ?
+                    CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC, &ts) < 0) {
+    throw std::system_error(errno, std::system_category(), "clock_gettime");
+  }
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000UL + ts.tv_nsec;
+}
+
+bool MonotonicClock::IsTscReliable() {
+#ifdef CCB_HAVE_TSC
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  // invariant TSC runs at a constant rate in all ACPI states
+  return edx & (1U << 8);
+#else
+  return false;
+#endif
+}
+
+}  // namespace ccb
@@ -0,0 +1,91 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CCBASE_CLOCK_H_
+#define CCBASE_CLOCK_H_
+
+#include <time.h>
+#include <stdint.h>
+#include <system_error>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CCB_HAVE_TSC 1
+#endif
+
+namespace ccb {
+
+enum class ClockSource {
+  kMonotonic,        // clock_gettime(CLOCK_MONOTONIC)
+  kMonotonicCoarse,  // CLOCK_MONOTONIC_COARSE, cheapest but jiffy precision
+  kTsc,              // calibrated invariant TSC, kMonotonic if unavailable
+};
+
+// MonotonicClock reads nanoseconds from the selected source. Conversion
+// of TSC cycles is a multiply and shift without any division.
+class MonotonicClock {
+ public:
+  explicit MonotonicClock(ClockSource source = ClockSource::kMonotonic);
+
+  ClockSource source() const {
+    return source_;
+  }
+  // nanoseconds since an unspecified start point
+  uint64_t NowNs() const {
+#ifdef CCB_HAVE_TSC
+    if (source_ == ClockSource::kTsc) {
+      return static_cast<uint64_t>(
+          (static_cast<unsigned __int128>(__rdtsc()) * tsc_mult_) >> kTscShift);
+    }
+#endif
+    struct timespec ts;
+    if (clock_gettime(clock_id_, &ts) < 0) {
+      throw std::system_error(errno, std::system_category(), "clock_gettime");
+    }
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000UL + ts.tv_nsec;
+  }
+  // nanoseconds from @source without keeping an instance, the TSC is
+  // calibrated once for the process
+  static uint64_t NowNs(ClockSource source);
+  // whether the TSC is invariant and so can be used as kTsc source
+  static bool IsTscReliable();
+
+ private:
+  static constexpr unsigned kTscShift = 32;
+
+  // the calibrated multiplier or 0 if the TSC is not reliable
+  static uint64_t TscMult();
+
+  ClockSource source_;
+  clockid_t clock_id_;
+  uint64_t tsc_mult_;
+};
+
+}  // namespace ccb
+
+#endif  // CCBASE_CLOCK_H_
@@ -105,6 +105,12 @@ class ConcurrentPtr {
     Reset(nullptr, sync_cleanup);
   }
 
+  /* Replace the pointer and retire the old one
+   *
+   * With sync_cleanup the call waits for the old one to be reclaimed. Under
+   * QSBRReclamation that needs every thread which has read the pointer to
+   * announce a quiescent state or go offline, see QSBRDomain.
+   */
   void Reset(T* ptr, bool sync_cleanup = false) {
     T* old_ptr = ptr_.exchange(ptr, std::memory_order_seq_cst);
     if (old_ptr)
@@ -0,0 +1,487 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <sys/time.h>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include "ccbase/concurrent_token_bucket.h"
+
+#define TV2US(ptv) ((ptv)->tv_sec * 1000000 + (ptv)->tv_usec)
+
+namespace ccb {
+
+namespace {
+
+constexpr int64_t kMicroTokens = 1000000;
+
+// floor modulo of micro-tokens, i.e. the fraction of a token
+int64_t MicroTokensFraction(int64_t micro_tokens) {
+  int64_t fraction = micro_tokens % kMicroTokens;
+  return (fraction < 0 ? fraction + kMicroTokens : fraction);
+}
+
+// floor division of micro-tokens, i.e. whole tokens
+int64_t MicroTokensWhole(int64_t micro_tokens) {
+  return (micro_tokens - MicroTokensFraction(micro_tokens)) / kMicroTokens;
+}
+
+}  // namespace
+
+AtomicTokenBucket::AtomicTokenBucket(uint32_t tokens_per_sec)
+  : AtomicTokenBucket(tokens_per_sec, tokens_per_sec / 5) {}
+
+AtomicTokenBucket::AtomicTokenBucket(uint32_t tokens_per_sec,
+                                     uint32_t bucket_size)
+  : AtomicTokenBucket(tokens_per_sec, bucket_size, bucket_size) {}
+
+AtomicTokenBucket::AtomicTokenBucket(uint32_t tokens_per_sec,
+                                     uint32_t bucket_size,
+                                     uint32_t init_tokens,
+                                     ClockSource clock_source)
+    : tokens_per_sec_(tokens_per_sec),
+      bucket_size_(bucket_size ? bucket_size : 1),
+      clock_source_(clock_source),
+      use_clock_(true) {
+  state_.micro_tokens = static_cast<int64_t>(init_tokens) * kMicroTokens;
+  state_.last_gen_time = ClockUs(nullptr);
+}
+
+AtomicTokenBucket::AtomicTokenBucket(uint32_t tokens_per_sec,
+                                     uint32_t bucket_size,
+                                     uint32_t init_tokens,
+                                     const struct timeval* tv_now)
+    : tokens_per_sec_(tokens_per_sec),
+      bucket_size_(bucket_size ? bucket_size : 1),
+      clock_source_(ClockSource::kMonotonic),
+      use_clock_(false) {
+  state_.micro_tokens = static_cast<int64_t>(init_tokens) * kMicroTokens;
+  state_.last_gen_time = ClockUs(tv_now);
+}
+
+uint64_t AtomicTokenBucket::ClockUs(const struct timeval* tv_now) const {
+  if (tv_now) {
+    return TV2US(tv_now);
+  }
+  if (use_clock_) {
+    return MonotonicClock::NowNs(clock_source_) / 1000;
+  }
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return TV2US(&tv);
+}
+
+void AtomicTokenBucket::Mod(uint32_t tokens_per_sec, uint32_t bucket_size) {
+  tokens_per_sec_.store(tokens_per_sec, std::memory_order_relaxed);
+  bucket_size_.store(bucket_size, std::memory_order_relaxed);
+}
+
+AtomicTokenBucket::State AtomicTokenBucket::Load() const {
+  // last_gen_time goes back only on a step of the clock, so micro_tokens
+  // read between two equal last_gen_time reads belongs to a state of that
+  // time
+  const volatile State* p = &state_;
+  State state;
+  uint64_t time;
+  do {
+    time = __atomic_load_n(&p->last_gen_time, __ATOMIC_ACQUIRE);
+    state.micro_tokens = __atomic_load_n(&p->micro_tokens, __ATOMIC_ACQUIRE);
+    state.last_gen_time = __atomic_load_n(&p->last_gen_time, __ATOMIC_ACQUIRE);
+  } while (time != state.last_gen_time);
+  return state;
+}
+
+bool AtomicTokenBucket::CompareExchange(State* expected,
+                                        const State& desired) {
+#if defined(__x86_64__)
+  bool res;
+  __asm__ __volatile__(
+      "lock cmpxchg16b %1\n\t"
+      "setz %0"
+      : "=q"(res), "+m"(state_),
+        "+a"(expected->micro_tokens), "+d"(expected->last_gen_time)
+      : "b"(desired.micro_tokens), "c"(desired.last_gen_time)
+      : "cc", "memory");
+  return res;
+#else
+  return __atomic_compare_exchange(&state_, expected,
+                                   const_cast<State*>(&desired), true,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+AtomicTokenBucket::State AtomicTokenBucket::Refill(State state,
+                                                   uint64_t us_now) const {
+  // the same as TokenBucket::Gen() with the fraction kept in micro-tokens
+  if (us_now <= state.last_gen_time) {
+    return state;
+  }
+  uint64_t us_past = us_now - state.last_gen_time;
+  __int128 micro_tokens = state.micro_tokens +
+      static_cast<__int128>(tokens_per_sec_.load(std::memory_order_relaxed))
+      * us_past;
+  __int128 max_micro_tokens =
+      static_cast<__int128>(bucket_size_.load(std::memory_order_relaxed))
+      * kMicroTokens + MicroTokensFraction(
+          static_cast<int64_t>(micro_tokens % kMicroTokens));
+  if (micro_tokens > max_micro_tokens) {
+    micro_tokens = max_micro_tokens;
+  }
+  state.micro_tokens = static_cast<int64_t>(micro_tokens);
+  state.last_gen_time = us_now;
+  return state;
+}
+
+void AtomicTokenBucket::Gen(const struct timeval* tv_now) {
+  State state = Load();
+  State desired;
+  do {
+    // the clock is read after the state, so a time before last_gen_time is
+    // a step back of the clock rather than a racing thread
+    uint64_t us_now = ClockUs(tv_now);
+    if (us_now == state.last_gen_time) {
+      return;
+    }
+    if (us_now < state.last_gen_time) {
+      // re-base like TokenBucket::Gen()
+      desired = state;
+      desired.last_gen_time = us_now;
+    } else {
+      desired = Refill(state, us_now);
+    }
+  } while (!CompareExchange(&state, desired));
+}
+
+uint32_t AtomicTokenBucket::tokens() const {
+  int64_t tokens = MicroTokensWhole(Load().micro_tokens);
+  return static_cast<uint32_t>(tokens <= 0 ? 0 : tokens);
+}
+
+bool AtomicTokenBucket::Check(uint32_t need_tokens) {
+  State state = Refill(Load(), ClockUs(nullptr));
+  return MicroTokensWhole(state.micro_tokens) >= need_tokens;
+}
+
+bool AtomicTokenBucket::Get(uint32_t need_tokens) {
+  uint64_t us_now = ClockUs(nullptr);
+  State state = Load();
+  State desired;
+  do {
+    desired = Refill(state, us_now);
+    if (MicroTokensWhole(desired.micro_tokens) < need_tokens) {
+      return false;
+    }
+    desired.micro_tokens -= static_cast<int64_t>(need_tokens) * kMicroTokens;
+  } while (!CompareExchange(&state, desired));
+  return true;
+}
+
+int AtomicTokenBucket::Overdraft(uint32_t need_tokens) {
+  uint64_t us_now = ClockUs(nullptr);
+  State state = Load();
+  State desired;
+  do {
+    desired = Refill(state, us_now);
+    desired.micro_tokens -= static_cast<int64_t>(need_tokens) * kMicroTokens;
+  } while (!CompareExchange(&state, desired));
+  int64_t tokens = MicroTokensWhole(desired.micro_tokens);
+  return static_cast<int>(tokens < 0 ? -tokens : 0);
+}
+
+void AtomicTokenBucket::Put(uint32_t tokens) {
+  uint64_t us_now = ClockUs(nullptr);
+  State state = Load();
+  State desired;
+  do {
+    desired = Refill(state, us_now);
+    int64_t micro_tokens = desired.micro_tokens +
+                           static_cast<int64_t>(tokens) * kMicroTokens;
+    int64_t max_micro_tokens =
+        static_cast<int64_t>(bucket_size_.load(std::memory_order_relaxed))
+        * kMicroTokens + MicroTokensFraction(desired.micro_tokens);
+    desired.micro_tokens = std::max(desired.micro_tokens,
+                                    std::min(micro_tokens, max_micro_tokens));
+  } while (!CompareExchange(&state, desired));
+}
+
+ShardedTokenBucket::ShardedTokenBucket(uint32_t tokens_per_sec,
+                                       uint32_t bucket_size,
+                                       uint32_t shard_tokens)
+    : core_(std::make_shared<Core>(tokens_per_sec, bucket_size)),
+      shard_tokens_(shard_tokens) {
+}
+
+ShardedTokenBucket::ShardHolder::~ShardHolder() {
+  // the thread exits, give the cached tokens back
+  if (shard) {
+    int64_t tokens = shard->tokens.exchange(0, std::memory_order_relaxed);
+    if (tokens > 0) {
+      core->global.Put(static_cast<uint32_t>(tokens));
+    }
+    core->shards.Free(shard);
+  }
+}
+
+ShardedTokenBucket::Shard* ShardedTokenBucket::LocalShard() {
+  ShardHolder& holder = tls_shard_.get();
+  if (!holder.shard) {
+    holder.core = core_;
+    holder.shard = core_->shards.Alloc();
+  }
+  return holder.shard;
+}
+
+bool ShardedTokenBucket::Get(uint32_t need_tokens) {
+  Shard* shard = LocalShard();
+  int64_t tokens = shard->tokens.load(std::memory_order_relaxed);
+  while (tokens >= need_tokens) {
+    // the CAS fails only if Rebalance() takes the tokens meanwhile
+    if (shard->tokens.compare_exchange_weak(tokens, tokens - need_tokens,
+                                            std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return Borrow(shard, need_tokens);
+}
+
+bool ShardedTokenBucket::Borrow(Shard* shard, uint32_t need_tokens) {
+  int64_t local = std::max<int64_t>(
+      shard->tokens.exchange(0, std::memory_order_relaxed), 0);
+  uint32_t lack = need_tokens - static_cast<uint32_t>(local);
+  shard->active.store(true, std::memory_order_relaxed);
+  // never ask for more than the global bucket can ever hold
+  uint64_t batch = std::min<uint64_t>(
+      static_cast<uint64_t>(lack) + shard_tokens_,
+      core_->global.bucket_size());
+  if (batch > lack && core_->global.Get(static_cast<uint32_t>(batch))) {
+    shard->tokens.fetch_add(static_cast<int64_t>(batch - lack),
+                            std::memory_order_relaxed);
+    return true;
+  }
+  if (core_->global.Get(lack)) {
+    return true;
+  }
+  shard->tokens.fetch_add(local, std::memory_order_relaxed);
+  return false;
+}
+
+bool ShardedTokenBucket::Check(uint32_t need_tokens) {
+  int64_t local = LocalShard()->tokens.load(std::memory_order_relaxed);
+  return (local >= need_tokens ||
+          core_->global.Check(need_tokens - static_cast<uint32_t>(
+              std::max<int64_t>(local, 0))));
+}
+
+int ShardedTokenBucket::Overdraft(uint32_t need_tokens) {
+  Shard* shard = LocalShard();
+  int64_t local = std::max<int64_t>(
+      shard->tokens.exchange(0, std::memory_order_relaxed), 0);
+  if (local >= need_tokens) {
+    shard->tokens.fetch_add(local - need_tokens, std::memory_order_relaxed);
+    return 0;
+  }
+  return core_->global.Overdraft(need_tokens - static_cast<uint32_t>(local));
+}
+
+uint32_t ShardedTokenBucket::tokens() const {
+  uint64_t tokens = core_->global.tokens();
+  core_->shards.Travel([&tokens](Shard* shard) {
+    tokens += std::max<int64_t>(
+        shard->tokens.load(std::memory_order_relaxed), 0);
+  });
+  return static_cast<uint32_t>(std::min<uint64_t>(tokens, UINT32_MAX));
+}
+
+void ShardedTokenBucket::Rebalance() {
+  Core* core = core_.get();
+  core->shards.Travel([core](Shard* shard) {
+    if (shard->active.exchange(false, std::memory_order_relaxed)) {
+      return;
+    }
+    // no borrowing since last time, return the surplus
+    int64_t tokens = shard->tokens.exchange(0, std::memory_order_relaxed);
+    if (tokens > 0) {
+      core->global.Put(static_cast<uint32_t>(tokens));
+    }
+  });
+}
+
+HierarchicalTokenBucket::HierarchicalTokenBucket(uint32_t tokens_per_sec,
+                                                 uint32_t bucket_size) {
+  nodes_.emplace_back(nullptr, tokens_per_sec, bucket_size);
+}
+
+HierarchicalTokenBucket::Node* HierarchicalTokenBucket::AddNode(
+    Node* parent, uint32_t tokens_per_sec, uint32_t bucket_size,
+    uint32_t ceil_per_sec, uint32_t ceil_bucket_size) {
+  if (parent == nullptr || parent->depth + 1 >= kMaxDepth) {
+    throw std::invalid_argument("HierarchicalTokenBucket: invalid parent");
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  nodes_.emplace_back(parent, tokens_per_sec, bucket_size);
+  Node* node = &nodes_.back();
+  if (ceil_per_sec) {
+    node->ceil.reset(new AtomicTokenBucket(
+        ceil_per_sec, ceil_bucket_size ? ceil_bucket_size : bucket_size));
+  }
+  return node;
+}
+
+bool HierarchicalTokenBucket::Get(Node* leaf, uint32_t need_tokens) {
+  Node* path[kMaxDepth];
+  size_t depth = 0;
+  Node* lender = nullptr;
+  Node* node = leaf;
+  for (; node; node = node->parent) {
+    if (node->ceil && !node->ceil->Get(need_tokens)) {
+      break;
+    }
+    path[depth++] = node;
+    if (node->rate.Get(need_tokens)) {
+      lender = node;
+      node = node->parent;
+      break;
+    }
+  }
+  // the ancestors above the lender must stay under their ceils as well
+  for (; lender && node; node = node->parent) {
+    if (node->ceil && !node->ceil->Get(need_tokens)) {
+      break;
+    }
+    path[depth++] = node;
+  }
+  if (lender && !node) {
+    // the borrowers below and the ancestors above are charged too
+    for (size_t i = 0; i < depth; i++) {
+      if (path[i] != lender) path[i]->rate.Overdraft(need_tokens);
+    }
+    return true;
+  }
+  // roll back the tokens taken on the way
+  if (lender) lender->rate.Put(need_tokens);
+  for (size_t i = 0; i < depth; i++) {
+    if (path[i]->ceil) path[i]->ceil->Put(need_tokens);
+  }
+  return false;
+}
+
+bool HierarchicalTokenBucket::Check(Node* leaf, uint32_t need_tokens) {
+  Node* node = leaf;
+  for (; node; node = node->parent) {
+    if (node->ceil && !node->ceil->Check(need_tokens)) {
+      return false;
+    }
+    if (node->rate.Check(need_tokens)) {
+      break;
+    }
+  }
+  if (!node) {
+    return false;
+  }
+  for (node = node->parent; node; node = node->parent) {
+    if (node->ceil && !node->ceil->Check(need_tokens)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t HierarchicalTokenBucket::tokens(const Node* node) const {
+  return node->rate.tokens();
+}
+
+AsyncTokenBucket::AsyncTokenBucket(uint32_t tokens_per_sec,
+                                   uint32_t bucket_size,
+                                   TimerWheel* timer_wheel)
+    : bucket_(tokens_per_sec, bucket_size, bucket_size,
+              ClockSource::kMonotonic),
+      timer_wheel_(timer_wheel) {
+}
+
+void AsyncTokenBucket::AcquireAsync(uint32_t need_tokens,
+                                    ClosureFunc<void()> callback) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bucket_.Gen();
+    if (!waiters_.empty() || !bucket_.Get(need_tokens)) {
+      if (bucket_.TimeUntil(need_tokens) == UINT64_MAX) {
+        throw std::invalid_argument("AsyncTokenBucket: too many tokens");
+      }
+      waiters_.push_back(Waiter{need_tokens, std::move(callback)});
+      if (waiters_.size() == 1) {
+        ArmTimerInLock();
+      }
+      return;
+    }
+  }
+  callback();
+}
+
+uint64_t AsyncTokenBucket::TimeUntil(uint32_t need_tokens) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  bucket_.Gen();
+  return bucket_.TimeUntil(need_tokens);
+}
+
+size_t AsyncTokenBucket::waiters() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return waiters_.size();
+}
+
+void AsyncTokenBucket::ArmTimerInLock() {
+  uint64_t us = bucket_.TimeUntil(waiters_.front().need_tokens);
+  size_t us_per_tick = timer_wheel_->GetUsPerTick();
+  tick_t ticks = (us + us_per_tick - 1) / us_per_tick;
+  if (timer_owner_.has_timer()) {
+    timer_wheel_->ResetTimer(timer_owner_, ticks);
+  } else {
+    timer_wheel_->AddTimer(ticks, [this] { OnTimer(); }, &timer_owner_);
+  }
+}
+
+void AsyncTokenBucket::OnTimer() {
+  std::vector<ClosureFunc<void()>> ready;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bucket_.Gen();
+    while (!waiters_.empty() &&
+           bucket_.Get(waiters_.front().need_tokens)) {
+      ready.push_back(std::move(waiters_.front().callback));
+      waiters_.pop_front();
+    }
+    if (!waiters_.empty()) {
+      ArmTimerInLock();
+    }
+  }
+  for (auto& callback : ready) {
+    callback();
+  }
+}
+
+}  // namespace ccb
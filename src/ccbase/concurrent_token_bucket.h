@@ -0,0 +1,227 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CCBASE_CONCURRENT_TOKEN_BUCKET_H_
+#define CCBASE_CONCURRENT_TOKEN_BUCKET_H_
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include "ccbase/common.h"
+#include "ccbase/accumulated_list.h"
+#include "ccbase/clock.h"
+#include "ccbase/thread_local_obj.h"
+#include "ccbase/timer_wheel.h"
+#include "ccbase/token_bucket.h"
+
+namespace ccb {
+
+// Thread-safe and lock-free version of TokenBucket. The token count and the
+// last refill time are updated together by a 128-bit CAS, and tokens are
+// refilled lazily in every call. Tokens are kept in micro-tokens so the
+// fraction carried by a refill is exactly TokenBucket::last_calc_delta_.
+// Time is read from a monotonic clock_source, so a step of the wall clock
+// stalls no refill, unless the bucket is created with an explicit tv_now,
+// which selects gettimeofday() like TokenBucket. Explicit tv_now of Gen()
+// should be of the same time base. Like TokenBucket, Gen() re-bases the
+// bucket if the time goes back, other calls refill nothing until then.
+class AtomicTokenBucket {
+ public:
+  explicit AtomicTokenBucket(uint32_t tokens_per_sec);
+  AtomicTokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size);
+  AtomicTokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size,
+                    uint32_t init_tokens,
+                    ClockSource clock_source = ClockSource::kMonotonic);
+  AtomicTokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size,
+                    uint32_t init_tokens, const struct timeval* tv_now);
+
+  void Gen(const struct timeval* tv_now = nullptr);
+  bool Get(uint32_t need_tokens = 1);
+  void Mod(uint32_t tokens_per_sec, uint32_t bucket_size);
+  uint32_t tokens() const;
+  bool Check(uint32_t need_tokens);
+  int Overdraft(uint32_t need_tokens);
+  // give back tokens taken before, never exceeds the bucket size
+  void Put(uint32_t tokens);
+  uint32_t bucket_size() const {
+    return bucket_size_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(AtomicTokenBucket);
+
+  struct alignas(16) State {
+    int64_t micro_tokens;
+    uint64_t last_gen_time;
+  };
+  State Load() const;
+  bool CompareExchange(State* expected, const State& desired);
+  State Refill(State state, uint64_t us_now) const;
+  uint64_t ClockUs(const struct timeval* tv_now) const;
+
+  std::atomic<uint32_t> tokens_per_sec_;
+  std::atomic<uint32_t> bucket_size_;
+  ClockSource clock_source_;
+  bool use_clock_;
+  State state_;
+};
+
+// ShardedTokenBucket splits a rate over per-thread shards. A thread takes
+// tokens from its own shard without any shared write, and borrows a batch
+// of shard_tokens from the global AtomicTokenBucket when the shard runs dry.
+// Tokens cached in shards are the only error to the global rate, so it is
+// bounded by shard_tokens per active thread. Rebalance() should be called
+// periodically to return the tokens of idle shards to the global bucket.
+class ShardedTokenBucket {
+ public:
+  ShardedTokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size,
+                     uint32_t shard_tokens);
+
+  bool Get(uint32_t need_tokens = 1);
+  bool Check(uint32_t need_tokens);
+  int Overdraft(uint32_t need_tokens);
+  // approximate tokens of the global bucket and all shards
+  uint32_t tokens() const;
+  void Rebalance();
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(ShardedTokenBucket);
+
+  struct Shard {
+    std::atomic<int64_t> tokens{0};
+    // set when borrowing and cleared by Rebalance()
+    std::atomic<bool> active{false};
+    // keep shards of different threads in different cache lines
+    char padding[64];
+  };
+  struct Core {
+    AtomicTokenBucket global;
+    AllocatedList<Shard> shards;
+
+    Core(uint32_t tokens_per_sec, uint32_t bucket_size)
+        : global(tokens_per_sec, bucket_size) {}
+  };
+  struct ShardHolder {
+    std::shared_ptr<Core> core;
+    Shard* shard = nullptr;
+
+    ~ShardHolder();
+  };
+
+  Shard* LocalShard();
+  bool Borrow(Shard* shard, uint32_t need_tokens);
+
+  std::shared_ptr<Core> core_;
+  uint32_t shard_tokens_;
+  ThreadLocalObj<ShardHolder> tls_shard_;
+};
+
+// HierarchicalTokenBucket is a tree of buckets, e.g. tenant -> user ->
+// endpoint, evaluated by one call on the path from a leaf to the root.
+// Like HTB, each node has an assured rate and an optional ceil. A node
+// without enough tokens of its own borrows from the nearest ancestor that
+// has them, and every node on the path must stay under its ceil. A granted
+// request is charged to all nodes on the path, borrowers and ancestors of
+// the lender may go into debt. Levels are taken one by one and the tokens
+// taken are put back if any level fails, so it is all or nothing.
+class HierarchicalTokenBucket {
+ public:
+  struct Node;
+  static constexpr size_t kMaxDepth = 16;
+
+  HierarchicalTokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size);
+
+  Node* root() {
+    return &nodes_.front();
+  }
+  // ceil_per_sec = 0 means the node is only limited by its ancestors
+  Node* AddNode(Node* parent, uint32_t tokens_per_sec, uint32_t bucket_size,
+                uint32_t ceil_per_sec = 0, uint32_t ceil_bucket_size = 0);
+  bool Get(Node* leaf, uint32_t need_tokens = 1);
+  bool Check(Node* leaf, uint32_t need_tokens);
+  uint32_t tokens(const Node* node) const;
+
+  struct Node {
+    Node* parent;
+    size_t depth;
+    AtomicTokenBucket rate;
+    std::unique_ptr<AtomicTokenBucket> ceil;
+
+    Node(Node* parent, uint32_t tokens_per_sec, uint32_t bucket_size)
+        : parent(parent), depth(parent ? parent->depth + 1 : 0),
+          rate(tokens_per_sec, bucket_size) {}
+  };
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(HierarchicalTokenBucket);
+
+  std::mutex mutex_;  // guard adding nodes
+  std::deque<Node> nodes_;
+};
+
+// AsyncTokenBucket queues the acquirers which can not get tokens now and
+// invokes their callbacks in FIFO order from timer_wheel. Only one timer is
+// armed for the head waiter at the time computed by TimeUntil(), so waiters
+// neither poll nor wake up all at once. The timer wheel must be locked if
+// AcquireAsync() is called from threads other than the wheel thread.
+class AsyncTokenBucket {
+ public:
+  AsyncTokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size,
+                   TimerWheel* timer_wheel);
+
+  // callback is invoked once need_tokens are taken, in the calling thread
+  // if available now and nobody is waiting, or else in the wheel thread
+  void AcquireAsync(uint32_t need_tokens, ClosureFunc<void()> callback);
+  // microseconds until need_tokens are available, ignoring the waiters
+  uint64_t TimeUntil(uint32_t need_tokens);
+  size_t waiters() const;
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(AsyncTokenBucket);
+
+  struct Waiter {
+    uint32_t need_tokens;
+    ClosureFunc<void()> callback;
+  };
+  void ArmTimerInLock();
+  void OnTimer();
+
+  mutable std::mutex mutex_;
+  TokenBucket bucket_;
+  std::deque<Waiter> waiters_;
+  TimerWheel* timer_wheel_;
+  TimerOwner timer_owner_;
+};
+
+}  // namespace ccb
+
+#endif  // CCBASE_CONCURRENT_TOKEN_BUCKET_H_
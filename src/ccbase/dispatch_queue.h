@@ -49,6 +49,9 @@ class DispatchQueue {
    public:
     virtual bool Push(const T& val) = 0;
     virtual bool Push(T&& val) = 0;
+    // push to any consumer and return index of the chosen consumer in @idx
+    virtual bool Push(const T& val, size_t* idx) = 0;
+    virtual bool Push(T&& val, size_t* idx) = 0;
     virtual bool Push(size_t idx, const T& val) = 0;
     virtual bool Push(size_t idx, T&& val) = 0;
     virtual void Unregister() = 0;
@@ -60,6 +63,10 @@ class DispatchQueue {
    public:
     virtual bool Pop(T* ptr) = 0;
     virtual bool PopWait(T* ptr, int timeout) = 0;
+    // allocate and touch queues on the calling thread for up to @num
+    // producers registered later, so that memory read by the consumer is
+    // local to it even though producers register on other threads
+    virtual void ReserveQueues(size_t num) = 0;
    protected:
     virtual ~InQueue() {}
   };
@@ -99,8 +106,14 @@ class DispatchQueue<T, kMaxProducers, kMaxConsumers>::Producer
       // std::atomic_init is not available in gcc-4.9
       ap.store(nullptr, std::memory_order_relaxed);
   }
-  bool Push(const T& val) override;
-  bool Push(T&& val) override;
+  bool Push(const T& val) override {
+    return Push(val, nullptr);
+  }
+  bool Push(T&& val) override {
+    return Push(std::move(val), nullptr);
+  }
+  bool Push(const T& val, size_t* idx) override;
+  bool Push(T&& val, size_t* idx) override;
   bool Push(size_t idx, const T& val) override;
   bool Push(size_t idx, T&& val) override;
   void Unregister() override;
@@ -116,7 +129,7 @@ class DispatchQueue<T, kMaxProducers, kMaxConsumers>::Producer
 
 template <class T, size_t kMaxProducers, size_t kMaxConsumers>
 bool DispatchQueue<T, kMaxProducers, kMaxConsumers>
-    ::Producer::Push(const T& val) {
+    ::Producer::Push(const T& val, size_t* idx) {
   if (!is_registered_) {
     throw std::logic_error("push unregistered OutQueue");
     return false;
@@ -126,22 +139,26 @@ bool DispatchQueue<T, kMaxProducers, kMaxConsumers>
     Queue* qptr = queue_vec_[cur_index_].load(std::memory_order_acquire);
     if (qptr == nullptr)
       break;
-    if (qptr->Push(val))
+    if (qptr->Push(val)) {
+      if (idx) *idx = cur_index_;
       return true;
+    }
   }
   for (cur_index_ = 0; cur_index_ <= last_index; cur_index_++) {
     Queue* qptr = queue_vec_[cur_index_].load(std::memory_order_acquire);
     if (qptr == nullptr)
       break;
-    if (qptr->Push(val))
+    if (qptr->Push(val)) {
+      if (idx) *idx = cur_index_;
       return true;
+    }
   }
   return false;
 }
 
 template <class T, size_t kMaxProducers, size_t kMaxConsumers>
 bool DispatchQueue<T, kMaxProducers, kMaxConsumers>
-    ::Producer::Push(T&& val) {
+    ::Producer::Push(T&& val, size_t* idx) {
   if (!is_registered_) {
     throw std::logic_error("push unregistered OutQueue");
     return false;
@@ -151,15 +168,19 @@ bool DispatchQueue<T, kMaxProducers, kMaxConsumers>
     Queue* qptr = queue_vec_[cur_index_].load(std::memory_order_acquire);
     if (qptr == nullptr)
       break;
-    if (qptr->Push(std::move(val)))
+    if (qptr->Push(std::move(val))) {
+      if (idx) *idx = cur_index_;
       return true;
+    }
   }
   for (cur_index_ = 0; cur_index_ <= last_index; cur_index_++) {
     Queue* qptr = queue_vec_[cur_index_].load(std::memory_order_acquire);
     if (qptr == nullptr)
       break;
-    if (qptr->Push(std::move(val)))
+    if (qptr->Push(std::move(val))) {
+      if (idx) *idx = cur_index_;
       return true;
+    }
   }
   return false;
 }
@@ -207,22 +228,32 @@ class DispatchQueue<T, kMaxProducers, kMaxConsumers>::Consumer
  public:
   Consumer(DispatchQueue<T, kMaxProducers, kMaxConsumers>* dq, size_t idx)
       : dispatch_queue_(dq), consumer_index_(idx), cur_index_(-1U),
-        cur_index_read_cnt_(0) {
+        cur_index_read_cnt_(0), reserved_count_(0) {
     for (auto& ap : queue_vec_)
       // std::atomic_init is not available in gcc-4.9
       ap.store(nullptr, std::memory_order_relaxed);
   }
+  ~Consumer() {
+    for (Queue* queue : reserved_queues_)
+      delete queue;
+  }
   bool Pop(T* ptr) override;
   bool PopWait(T* ptr, int timeout) override;
+  void ReserveQueues(size_t num) override;
 
  private:
   friend class DispatchQueue<T, kMaxProducers, kMaxConsumers>;
+  // called with dispatch_queue_->mutex_ held
+  Queue* NewQueue();
+
   static constexpr size_t kMaxStickyReadCnt = 32;
   DispatchQueue<T, kMaxProducers, kMaxConsumers>* dispatch_queue_;
   size_t consumer_index_;
   size_t cur_index_;
   size_t cur_index_read_cnt_;
   std::atomic<Queue*> queue_vec_[kMaxProducers];
+  std::vector<Queue*> reserved_queues_;
+  std::atomic<size_t> reserved_count_;
 };
 
 template <class T, size_t kMaxProducers, size_t kMaxConsumers>
@@ -274,6 +305,34 @@ bool DispatchQueue<T, kMaxProducers, kMaxConsumers>
   return true;
 }
 
+template <class T, size_t kMaxProducers, size_t kMaxConsumers>
+void DispatchQueue<T, kMaxProducers, kMaxConsumers>
+    ::Consumer::ReserveQueues(size_t num) {
+  size_t count = reserved_count_.load(std::memory_order_relaxed);
+  if (count >= num)
+    return;
+  std::vector<Queue*> queues;
+  for (; count < num; count++) {
+    Queue* queue = new Queue(dispatch_queue_->qlen_);
+    queue->Prefault();
+    queues.push_back(queue);
+  }
+  std::lock_guard<std::mutex> lock(dispatch_queue_->mutex_);
+  reserved_queues_.insert(reserved_queues_.end(), queues.begin(), queues.end());
+  reserved_count_.store(reserved_queues_.size(), std::memory_order_relaxed);
+}
+
+template <class T, size_t kMaxProducers, size_t kMaxConsumers>
+typename DispatchQueue<T, kMaxProducers, kMaxConsumers>::Queue*
+DispatchQueue<T, kMaxProducers, kMaxConsumers>::Consumer::NewQueue() {
+  if (reserved_queues_.empty())
+    return new Queue(dispatch_queue_->qlen_);
+  Queue* queue = reserved_queues_.back();
+  reserved_queues_.pop_back();
+  reserved_count_.store(reserved_queues_.size(), std::memory_order_relaxed);
+  return queue;
+}
+
 
 template <class T, size_t kMaxProducers, size_t kMaxConsumers>
 DispatchQueue<T, kMaxProducers, kMaxConsumers>::DispatchQueue(size_t qlen)
@@ -321,7 +380,7 @@ DispatchQueue<T, kMaxProducers, kMaxConsumers>::RegisterProducer() {
   Producer* producer = new Producer(this, producer_count);
   for (size_t i = 0; i < consumer_count_.load(std::memory_order_relaxed); i++) {
     Consumer* consumer = consumers_[i].load(std::memory_order_relaxed);
-    Queue* queue = new Queue(qlen_);
+    Queue* queue = consumer->NewQueue();
     consumer->queue_vec_[producer_count] = queue;
     producer->queue_vec_[i] = queue;
   }
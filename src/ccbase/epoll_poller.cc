@@ -0,0 +1,117 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <limits>
+#include <system_error>
+#include <utility>
+#include "ccbase/epoll_poller.h"
+
+namespace ccb {
+
+EpollPoller::EpollPoller() {
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd_ < 0) {
+    throw std::system_error(errno, std::system_category(), "epoll_create1");
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = wakeup_fd_.fd();
+  if (epoll_ctl(epfd_, EPOLL_CTL_ADD, wakeup_fd_.fd(), &ev) < 0) {
+    int err = errno;
+    close(epfd_);
+    throw std::system_error(err, std::system_category(), "epoll_ctl");
+  }
+}
+
+EpollPoller::~EpollPoller() {
+  close(epfd_);
+}
+
+bool EpollPoller::AddFd(int fd, uint32_t events, EventHandler handler) {
+  if (fd == wakeup_fd_.fd() || !handler) {
+    return false;
+  }
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    return false;
+  }
+  handlers_[fd] = std::move(handler);
+  return true;
+}
+
+bool EpollPoller::ModFd(int fd, uint32_t events) {
+  if (handlers_.find(fd) == handlers_.end()) {
+    return false;
+  }
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+bool EpollPoller::DelFd(int fd) {
+  auto it = handlers_.find(fd);
+  if (it == handlers_.end()) {
+    return false;
+  }
+  handlers_.erase(it);
+  // the fd may have been closed already
+  epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+  return true;
+}
+
+void EpollPoller::Poll(size_t timeout_ms) {
+  struct epoll_event events[kMaxEvents];
+  int timeout = (timeout_ms == kInfiniteTimeout ? -1 :
+      static_cast<int>(std::min<size_t>(timeout_ms,
+                                        std::numeric_limits<int>::max())));
+  int n = epoll_wait(epfd_, events, kMaxEvents, timeout);
+  for (int i = 0; i < n; i++) {
+    int fd = events[i].data.fd;
+    if (fd == wakeup_fd_.fd()) {
+      wakeup_fd_.Get();
+      continue;
+    }
+    auto it = handlers_.find(fd);
+    if (it == handlers_.end()) {
+      // deleted by previous handlers
+      continue;
+    }
+    // hold a reference as the handler may delete itself
+    EventHandler handler = it->second;
+    handler(events[i].events);
+  }
+}
+
+}  // namespace ccb
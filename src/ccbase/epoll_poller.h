@@ -0,0 +1,77 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CCBASE_EPOLL_POLLER_H_
+#define CCBASE_EPOLL_POLLER_H_
+
+#include <sys/epoll.h>
+#include <unordered_map>
+#include "ccbase/common.h"
+#include "ccbase/closure.h"
+#include "ccbase/eventfd.h"
+#include "ccbase/worker_group.h"
+
+namespace ccb {
+
+// The default WorkerGroup poller which is a simple epoll event loop.
+// All methods except Wakeup() must be called in the owner worker thread.
+class EpollPoller : public WorkerGroup::Poller {
+ public:
+  using EventHandler = ClosureFunc<void(uint32_t events)>;
+
+  EpollPoller();
+  ~EpollPoller() override;
+
+  // register @fd with epoll @events, @handler is called with the ready events
+  bool AddFd(int fd, uint32_t events, EventHandler handler);
+  bool ModFd(int fd, uint32_t events);
+  bool DelFd(int fd);
+
+  void Poll(size_t timeout_ms) override;
+  bool HasWakeup() const override {
+    return true;
+  }
+  // thread-safe
+  void Wakeup() override {
+    wakeup_fd_.Notify();
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(EpollPoller);
+
+  static constexpr int kMaxEvents = 64;
+
+  int epfd_;
+  EventFd wakeup_fd_;
+  std::unordered_map<int, EventHandler> handlers_;
+};
+
+}  // namespace ccb
+
+#endif  // CCBASE_EPOLL_POLLER_H_
@@ -0,0 +1,306 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <system_error>
+#include <utility>
+#include "ccbase/io_uring_poller.h"
+
+namespace ccb {
+
+namespace {
+
+constexpr uint64_t kWakeupUserData = static_cast<uint64_t>(-1);
+
+inline unsigned LoadAcquire(const unsigned* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+inline void StoreRelease(unsigned* p, unsigned v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+}  // namespace
+
+IoUringPoller::IoUringPoller(unsigned entries)
+    : sqe_tail_(0), wakeup_buf_(0) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (ring_fd_ < 0) {
+    throw std::system_error(errno, std::system_category(), "io_uring_setup");
+  }
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    close(ring_fd_);
+    throw std::system_error(ENOTSUP, std::system_category(),
+                            "io_uring without IORING_FEAT_EXT_ARG");
+  }
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes
+                  + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP);
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sq_ring_ptr_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ptr_ == MAP_FAILED) {
+    int err = errno;
+    close(ring_fd_);
+    throw std::system_error(err, std::system_category(), "mmap sq ring");
+  }
+  cq_ring_ptr_ = sq_ring_ptr_;
+  if (!single_mmap) {
+    cq_ring_ptr_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_,
+                        IORING_OFF_CQ_RING);
+    if (cq_ring_ptr_ == MAP_FAILED) {
+      int err = errno;
+      munmap(sq_ring_ptr_, sq_ring_size_);
+      close(ring_fd_);
+      throw std::system_error(err, std::system_category(), "mmap cq ring");
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes_ptr = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes_ptr == MAP_FAILED) {
+    int err = errno;
+    if (!single_mmap) munmap(cq_ring_ptr_, cq_ring_size_);
+    munmap(sq_ring_ptr_, sq_ring_size_);
+    close(ring_fd_);
+    throw std::system_error(err, std::system_category(), "mmap sqes");
+  }
+  char* sq_ptr = static_cast<char*>(sq_ring_ptr_);
+  char* cq_ptr = static_cast<char*>(cq_ring_ptr_);
+  sq_entries_ = params.sq_entries;
+  sq_mask_ = *reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.ring_mask);
+  sq_head_ = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.ring_mask);
+  cq_head_ = reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.tail);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq_ptr + params.cq_off.cqes);
+  sqes_ = static_cast<struct io_uring_sqe*>(sqes_ptr);
+  // use identical index mapping so sqe index is always (tail & mask)
+  unsigned* sq_array = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; i++) {
+    sq_array[i] = i;
+  }
+  sqe_tail_ = *sq_tail_;
+  ArmWakeup();
+}
+
+IoUringPoller::~IoUringPoller() {
+  // closing the ring cancels all pending requests
+  munmap(sqes_, sqes_size_);
+  if (cq_ring_ptr_ != sq_ring_ptr_) munmap(cq_ring_ptr_, cq_ring_size_);
+  munmap(sq_ring_ptr_, sq_ring_size_);
+  close(ring_fd_);
+}
+
+struct io_uring_sqe* IoUringPoller::PrepareSqe(uint8_t opcode, int fd,
+                                               uint64_t user_data) {
+  // one entry is reserved for re-arming the wakeup read, which must never
+  // fail, as there is only one wakeup read at a time it always fits in
+  unsigned limit = (user_data == kWakeupUserData ? sq_entries_
+                                                  : sq_entries_ - 1);
+  if (sqe_tail_ - LoadAcquire(sq_head_) >= limit) {
+    // ring is full, flush queued sqes to kernel
+    Submit();
+    if (sqe_tail_ - LoadAcquire(sq_head_) >= limit) {
+      return nullptr;
+    }
+  }
+  struct io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+  sqe_tail_++;
+  return sqe;
+}
+
+bool IoUringPoller::PrepareRequest(uint8_t opcode, int fd, const void* addr,
+                                   uint32_t len, uint64_t off,
+                                   CompletionHandler handler,
+                                   struct io_uring_sqe** sqe_out) {
+  uint32_t slot;
+  if (free_slots_.empty()) {
+    slot = static_cast<uint32_t>(handlers_.size());
+    handlers_.emplace_back();
+  } else {
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+  }
+  struct io_uring_sqe* sqe = PrepareSqe(opcode, fd, slot);
+  if (!sqe) {
+    free_slots_.push_back(slot);
+    return false;
+  }
+  sqe->addr = reinterpret_cast<uint64_t>(addr);
+  sqe->len = len;
+  sqe->off = off;
+  handlers_[slot] = std::move(handler);
+  if (sqe_out) *sqe_out = sqe;
+  return true;
+}
+
+bool IoUringPoller::Read(int fd, void* buf, size_t len, off_t offset,
+                         CompletionHandler handler) {
+  return PrepareRequest(IORING_OP_READ, fd, buf, static_cast<uint32_t>(len),
+                        static_cast<uint64_t>(offset), std::move(handler));
+}
+
+bool IoUringPoller::Write(int fd, const void* buf, size_t len, off_t offset,
+                          CompletionHandler handler) {
+  return PrepareRequest(IORING_OP_WRITE, fd, buf, static_cast<uint32_t>(len),
+                        static_cast<uint64_t>(offset), std::move(handler));
+}
+
+bool IoUringPoller::Accept(int fd, struct sockaddr* addr, socklen_t* addrlen,
+                           CompletionHandler handler) {
+  // addr2 (the off field) carries the addrlen pointer
+  return PrepareRequest(IORING_OP_ACCEPT, fd, addr, 0,
+                        reinterpret_cast<uint64_t>(addrlen),
+                        std::move(handler));
+}
+
+bool IoUringPoller::Recv(int fd, void* buf, size_t len, int flags,
+                         CompletionHandler handler) {
+  struct io_uring_sqe* sqe;
+  if (!PrepareRequest(IORING_OP_RECV, fd, buf, static_cast<uint32_t>(len), 0,
+                      std::move(handler), &sqe)) {
+    return false;
+  }
+  sqe->msg_flags = static_cast<uint32_t>(flags);
+  return true;
+}
+
+bool IoUringPoller::Send(int fd, const void* buf, size_t len, int flags,
+                         CompletionHandler handler) {
+  struct io_uring_sqe* sqe;
+  if (!PrepareRequest(IORING_OP_SEND, fd, buf, static_cast<uint32_t>(len), 0,
+                      std::move(handler), &sqe)) {
+    return false;
+  }
+  sqe->msg_flags = static_cast<uint32_t>(flags);
+  return true;
+}
+
+void IoUringPoller::ArmWakeup() {
+  struct io_uring_sqe* sqe = PrepareSqe(IORING_OP_READ, wakeup_fd_.fd(),
+                                        kWakeupUserData);
+  assert(sqe);
+  sqe->addr = reinterpret_cast<uint64_t>(&wakeup_buf_);
+  sqe->len = sizeof(wakeup_buf_);
+}
+
+void IoUringPoller::Submit() {
+  // sqes published by a failed enter are not consumed yet, count them too
+  unsigned to_submit = sqe_tail_ - LoadAcquire(sq_head_);
+  if (to_submit > 0 && Enter(to_submit, 0, 0) < 0) {
+    CheckEnterError(errno);
+  }
+}
+
+void IoUringPoller::CheckEnterError(int err) {
+  // transient errors, the sqes are kept in the ring and retried later
+  if (err == EAGAIN || err == EBUSY || err == EINTR || err == ETIME) {
+    return;
+  }
+  throw std::system_error(err, std::system_category(), "io_uring_enter");
+}
+
+int IoUringPoller::Enter(unsigned to_submit, unsigned min_complete,
+                         size_t timeout_ms) {
+  // publish queued sqes
+  StoreRelease(sq_tail_, sqe_tail_);
+  unsigned flags = IORING_ENTER_EXT_ARG;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  if (min_complete > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+    if (timeout_ms != kInfiniteTimeout) {
+      ts.tv_sec = static_cast<int64_t>(timeout_ms / 1000);
+      ts.tv_nsec = static_cast<int64_t>(timeout_ms % 1000 * 1000000);
+      arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+  }
+  int res;
+  do {
+    res = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, to_submit,
+                                   min_complete, flags, &arg, sizeof(arg)));
+  } while (res < 0 && errno == EINTR && min_complete == 0);
+  return res;
+}
+
+void IoUringPoller::Poll(size_t timeout_ms) {
+  unsigned to_submit = sqe_tail_ - LoadAcquire(sq_head_);
+  bool has_cqe = (LoadAcquire(cq_tail_) != *cq_head_);
+  if (to_submit > 0 || (timeout_ms > 0 && !has_cqe)) {
+    if (Enter(to_submit, (timeout_ms > 0 && !has_cqe) ? 1 : 0,
+              timeout_ms) < 0) {
+      CheckEnterError(errno);
+    }
+  }
+  ReapCompletions();
+}
+
+size_t IoUringPoller::ReapCompletions() {
+  size_t count = 0;
+  unsigned head = *cq_head_;
+  while (head != LoadAcquire(cq_tail_)) {
+    struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+    uint64_t user_data = cqe->user_data;
+    int res = cqe->res;
+    // release the cqe before running handler to make room for new requests
+    StoreRelease(cq_head_, ++head);
+    if (user_data == kWakeupUserData) {
+      ArmWakeup();
+      continue;
+    }
+    uint32_t slot = static_cast<uint32_t>(user_data);
+    CompletionHandler handler{std::move(handlers_[slot])};
+    free_slots_.push_back(slot);
+    if (handler) handler(res);
+    count++;
+  }
+  return count;
+}
+
+}  // namespace ccb
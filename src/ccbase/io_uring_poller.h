@@ -0,0 +1,118 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CCBASE_IO_URING_POLLER_H_
+#define CCBASE_IO_URING_POLLER_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include <vector>
+#include "ccbase/common.h"
+#include "ccbase/closure.h"
+#include "ccbase/eventfd.h"
+#include "ccbase/worker_group.h"
+
+namespace ccb {
+
+// WorkerGroup poller owning one io_uring instance, supply one for each worker
+// to run completion handlers on that worker. Requests are queued and
+// submitted in batch by the next Poll() call (or when the ring is full).
+// One ring entry is reserved for the wakeup, so @entries must be at least 2.
+// Requires linux 5.11+ (IORING_FEAT_EXT_ARG), no liburing is needed.
+// All methods except Wakeup() must be called in the owner worker thread.
+class IoUringPoller : public WorkerGroup::Poller {
+ public:
+  // @res is the result of the syscall, negative errno if failed
+  using CompletionHandler = ClosureFunc<void(int res)>;
+
+  explicit IoUringPoller(unsigned entries = 256);
+  ~IoUringPoller() override;
+
+  bool Read(int fd, void* buf, size_t len, off_t offset,
+            CompletionHandler handler);
+  bool Write(int fd, const void* buf, size_t len, off_t offset,
+             CompletionHandler handler);
+  bool Accept(int fd, struct sockaddr* addr, socklen_t* addrlen,
+              CompletionHandler handler);
+  bool Recv(int fd, void* buf, size_t len, int flags,
+            CompletionHandler handler);
+  bool Send(int fd, const void* buf, size_t len, int flags,
+            CompletionHandler handler);
+  // submit queued requests without waiting, requests are kept queued on
+  // transient failures (e.g. EBUSY) and std::system_error is thrown on others
+  void Submit();
+
+  // throws std::system_error like Submit()
+  void Poll(size_t timeout_ms) override;
+  bool HasWakeup() const override {
+    return true;
+  }
+  // thread-safe
+  void Wakeup() override {
+    wakeup_fd_.Notify();
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(IoUringPoller);
+
+  struct io_uring_sqe* PrepareSqe(uint8_t opcode, int fd, uint64_t user_data);
+  bool PrepareRequest(uint8_t opcode, int fd, const void* addr,
+                      uint32_t len, uint64_t off, CompletionHandler handler,
+                      struct io_uring_sqe** sqe_out = nullptr);
+  void ArmWakeup();
+  int Enter(unsigned to_submit, unsigned min_complete, size_t timeout_ms);
+  void CheckEnterError(int err);
+  size_t ReapCompletions();
+
+  int ring_fd_;
+  unsigned sq_entries_;
+  unsigned sq_mask_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned cq_mask_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  struct io_uring_cqe* cqes_;
+  struct io_uring_sqe* sqes_;
+  void* sq_ring_ptr_;
+  size_t sq_ring_size_;
+  void* cq_ring_ptr_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+  unsigned sqe_tail_;   // local tail including queued but unsubmitted sqes
+  EventFd wakeup_fd_;
+  uint64_t wakeup_buf_;
+  std::vector<CompletionHandler> handlers_;
+  std::vector<uint32_t> free_slots_;
+};
+
+}  // namespace ccb
+
+#endif  // CCBASE_IO_URING_POLLER_H_
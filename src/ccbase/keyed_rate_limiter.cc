@@ -0,0 +1,336 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <stdexcept>
+#include "ccbase/keyed_rate_limiter.h"
+
+#define TV2NS(ptv) ((ptv)->tv_sec * 1000000000UL + (ptv)->tv_usec * 1000UL)
+
+namespace ccb {
+
+namespace {
+
+constexpr uint64_t kEmptyKey = 0;
+constexpr size_t kInitSlots = 16;
+
+// finalizer of murmur3
+inline uint64_t HashKey(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdUL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53UL;
+  key ^= key >> 33;
+  return key;
+}
+
+inline size_t RoundUpPowerOf2(size_t n) {
+  size_t v = 1;
+  while (v < n) v <<= 1;
+  return v;
+}
+
+}  // namespace
+
+KeyedRateLimiter::KeyedRateLimiter(uint32_t tokens_per_sec,
+                                   uint32_t bucket_size,
+                                   size_t max_keys, uint32_t ttl_ms,
+                                   TimerWheel* timer_wheel,
+                                   tick_t sweep_period,
+                                   size_t shards,
+                                   Algorithm algorithm)
+    : algorithm_(algorithm),
+      tokens_per_sec_(tokens_per_sec),
+      ttl_ms_(ttl_ms),
+      // a zero rate is rejected below if it is used
+      gcra_(std::max<uint32_t>(tokens_per_sec, 1), bucket_size),
+      gcra_ttl_(ttl_ms * 1000000UL << GcraConfig::kFracBits),
+      sweep_cursor_(0),
+      key_count_(0),
+      start_ns_(clock_.NowNs()) {
+  if (algorithm_ == Algorithm::kTokenBucket) {
+    if (bucket_size > kMaxBucketSize) {
+      throw std::invalid_argument("KeyedRateLimiter: bucket size too large");
+    }
+  } else if (tokens_per_sec == 0) {
+    throw std::invalid_argument("KeyedRateLimiter: zero rate");
+  }
+  max_milli_tokens_ = std::max<uint32_t>(bucket_size, 1) * 1000;
+  shard_count_ = RoundUpPowerOf2(std::max<size_t>(shards, 1));
+  shards_.reset(new Shard[shard_count_]);
+  max_keys_ = std::max<size_t>(max_keys, 1);
+  // twice the average leaves room for uneven hashing
+  max_keys_per_shard_ = (max_keys_ + shard_count_ - 1) / shard_count_ * 2;
+  // keep the load factor under 3/4
+  max_slots_per_shard_ = RoundUpPowerOf2(max_keys_per_shard_ * 4 / 3 + 1);
+  if (timer_wheel) {
+    timer_wheel->AddPeriodTimer(sweep_period, [this] {
+      EvictShard(&shards_[sweep_cursor_++ & (shard_count_ - 1)]);
+    }, &sweep_timer_);
+  }
+}
+
+uint64_t KeyedRateLimiter::Now(const struct timeval* tv_now) const {
+  if (algorithm_ == Algorithm::kGcra) {
+    return gcra_.Now(tv_now);
+  }
+  uint64_t ns_now = (tv_now ? TV2NS(tv_now) : clock_.NowNs());
+  // wraps every 49 days, differences stay correct
+  return static_cast<uint32_t>((ns_now - start_ns_) / 1000000);
+}
+
+bool KeyedRateLimiter::IsIdle(const Slot& slot, uint64_t now) const {
+  if (algorithm_ == Algorithm::kGcra) {
+    // a TAT in the future is in debt
+    return static_cast<int64_t>(now - slot.tat) >=
+           static_cast<int64_t>(gcra_ttl_);
+  }
+  // the time never goes back for a slot, so the idle time is right until
+  // it wraps in 49 days which is longer than any ttl_ms
+  uint32_t idle_ms = static_cast<uint32_t>(now) - slot.bucket.last_ms;
+  return idle_ms >= ttl_ms_;
+}
+
+void KeyedRateLimiter::KeepTat(Slot* slot, uint64_t now) const {
+  // keep an idle TAT from wrapping like GcraRateLimiter
+  uint64_t idle = now - slot->tat;
+  if (idle > GcraConfig::kMaxIdle / 2 && idle < GcraConfig::kMaxIdle) {
+    slot->tat = now - GcraConfig::kMaxIdle / 2;
+  }
+}
+
+void KeyedRateLimiter::Refill(Slot* slot, uint32_t now) const {
+  Bucket& bucket = slot->bucket;
+  uint32_t elapsed_ms = now - bucket.last_ms;
+  if (elapsed_ms > 0) {
+    uint64_t milli_tokens = bucket.milli_tokens +
+        static_cast<uint64_t>(elapsed_ms) * tokens_per_sec_;
+    bucket.milli_tokens = static_cast<uint32_t>(
+        std::min<uint64_t>(milli_tokens, max_milli_tokens_));
+    bucket.last_ms = now;
+  }
+}
+
+KeyedRateLimiter::Slot* KeyedRateLimiter::FindSlot(Shard* shard,
+                                                   uint64_t key,
+                                                   uint64_t hash) {
+  if (key == kEmptyKey) {
+    return shard->has_zero_key ? &shard->zero_key_slot : nullptr;
+  }
+  if (shard->slots.empty()) {
+    return nullptr;
+  }
+  size_t mask = shard->slots.size() - 1;
+  for (size_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+    Slot& slot = shard->slots[pos];
+    if (slot.key == key) {
+      return &slot;
+    }
+    if (slot.key == kEmptyKey) {
+      return nullptr;
+    }
+  }
+}
+
+KeyedRateLimiter::Slot* KeyedRateLimiter::InsertSlot(Shard* shard,
+                                                     uint64_t key,
+                                                     uint64_t hash,
+                                                     uint64_t now) {
+  if (shard->count >= max_keys_per_shard_ ||
+      key_count_.load(std::memory_order_relaxed) >= max_keys_) {
+    EvictShardInLock(shard, now);
+    if (shard->count >= max_keys_per_shard_ ||
+        key_count_.load(std::memory_order_relaxed) >= max_keys_) {
+      return nullptr;
+    }
+  }
+  Slot* slot;
+  if (key == kEmptyKey) {
+    shard->has_zero_key = true;
+    slot = &shard->zero_key_slot;
+  } else {
+    if ((shard->count + 1) * 4 > shard->slots.size() * 3) {
+      Grow(shard);
+    }
+    size_t mask = shard->slots.size() - 1;
+    size_t pos = hash & mask;
+    while (shard->slots[pos].key != kEmptyKey) {
+      pos = (pos + 1) & mask;
+    }
+    slot = &shard->slots[pos];
+  }
+  slot->key = key;
+  if (algorithm_ == Algorithm::kGcra) {
+    slot->tat = now;
+  } else {
+    slot->bucket.last_ms = static_cast<uint32_t>(now);
+    slot->bucket.milli_tokens = max_milli_tokens_;
+  }
+  shard->count++;
+  key_count_.fetch_add(1, std::memory_order_relaxed);
+  return slot;
+}
+
+void KeyedRateLimiter::Grow(Shard* shard) {
+  size_t new_size = std::min(
+      std::max(shard->slots.size() * 2, kInitSlots), max_slots_per_shard_);
+  if (new_size <= shard->slots.size()) {
+    return;
+  }
+  std::vector<Slot> old_slots(new_size, Slot{kEmptyKey, {{0, 0}}});
+  old_slots.swap(shard->slots);
+  size_t mask = new_size - 1;
+  for (const Slot& slot : old_slots) {
+    if (slot.key == kEmptyKey) {
+      continue;
+    }
+    size_t pos = HashKey(slot.key) & mask;
+    while (shard->slots[pos].key != kEmptyKey) {
+      pos = (pos + 1) & mask;
+    }
+    shard->slots[pos] = slot;
+  }
+}
+
+void KeyedRateLimiter::EraseSlot(Shard* shard, size_t pos) {
+  // backward shift deletion keeps probe sequences without tombstones
+  size_t mask = shard->slots.size() - 1;
+  size_t next = pos;
+  for (;;) {
+    next = (next + 1) & mask;
+    uint64_t key = shard->slots[next].key;
+    if (key == kEmptyKey) {
+      break;
+    }
+    size_t home = HashKey(key) & mask;
+    // move it unless its home lies cyclically in (pos, next]
+    if (((next - home) & mask) >= ((next - pos) & mask)) {
+      shard->slots[pos] = shard->slots[next];
+      pos = next;
+    }
+  }
+  shard->slots[pos].key = kEmptyKey;
+  shard->count--;
+  key_count_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void KeyedRateLimiter::EvictShard(Shard* shard,
+                                  const struct timeval* tv_now) {
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  EvictShardInLock(shard, Now(tv_now));
+}
+
+void KeyedRateLimiter::EvictShardInLock(Shard* shard, uint64_t now) {
+  if (shard->has_zero_key && IsIdle(shard->zero_key_slot, now)) {
+    shard->has_zero_key = false;
+    shard->count--;
+    key_count_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  for (size_t pos = 0; pos < shard->slots.size(); ) {
+    Slot& slot = shard->slots[pos];
+    if (slot.key != kEmptyKey && IsIdle(slot, now)) {
+      // another slot may be shifted here, check it again
+      EraseSlot(shard, pos);
+    } else {
+      if (slot.key != kEmptyKey && algorithm_ == Algorithm::kGcra) {
+        KeepTat(&slot, now);
+      }
+      pos++;
+    }
+  }
+}
+
+bool KeyedRateLimiter::Get(uint64_t key, uint32_t need_tokens,
+                           const struct timeval* tv_now) {
+  uint64_t need_milli_tokens = static_cast<uint64_t>(need_tokens) * 1000;
+  uint64_t hash = HashKey(key);
+  Shard& shard = SelectShard(hash);
+  // read the time in the lock so that it never goes back for a slot
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  uint64_t now = Now(tv_now);
+  Slot* slot = FindSlot(&shard, key, hash);
+  if (algorithm_ == Algorithm::kGcra) {
+    if (!slot) {
+      if (!gcra_.Check(now, now, need_tokens) ||
+          !(slot = InsertSlot(&shard, key, hash, now))) {
+        return false;
+      }
+    }
+    KeepTat(slot, now);
+    return gcra_.Get(&slot->tat, now, need_tokens);
+  }
+  if (slot) {
+    Refill(slot, static_cast<uint32_t>(now));
+  } else if (need_milli_tokens > max_milli_tokens_ ||
+             !(slot = InsertSlot(&shard, key, hash, now))) {
+    return false;
+  }
+  if (slot->bucket.milli_tokens < need_milli_tokens) {
+    return false;
+  }
+  slot->bucket.milli_tokens -= static_cast<uint32_t>(need_milli_tokens);
+  return true;
+}
+
+bool KeyedRateLimiter::Check(uint64_t key, uint32_t need_tokens,
+                             const struct timeval* tv_now) {
+  uint64_t need_milli_tokens = static_cast<uint64_t>(need_tokens) * 1000;
+  uint64_t hash = HashKey(key);
+  Shard& shard = SelectShard(hash);
+  // read the time in the lock so that it never goes back for a slot
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  uint64_t now = Now(tv_now);
+  Slot* slot = FindSlot(&shard, key, hash);
+  if (algorithm_ == Algorithm::kGcra) {
+    if (!slot) {
+      // an unknown key has a full bucket
+      return gcra_.Check(now, now, need_tokens);
+    }
+    KeepTat(slot, now);
+    return gcra_.Check(slot->tat, now, need_tokens);
+  }
+  if (!slot) {
+    // an unknown key has a full bucket
+    return need_milli_tokens <= max_milli_tokens_;
+  }
+  Refill(slot, static_cast<uint32_t>(now));
+  return slot->bucket.milli_tokens >= need_milli_tokens;
+}
+
+void KeyedRateLimiter::Evict(const struct timeval* tv_now) {
+  for (size_t i = 0; i < shard_count_; i++) {
+    EvictShard(&shards_[i], tv_now);
+  }
+}
+
+size_t KeyedRateLimiter::size() const {
+  return key_count_.load(std::memory_order_relaxed);
+}
+
+}  // namespace ccb
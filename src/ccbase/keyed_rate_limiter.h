@@ -0,0 +1,144 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CCBASE_KEYED_RATE_LIMITER_H_
+#define CCBASE_KEYED_RATE_LIMITER_H_
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ccbase/clock.h"
+#include "ccbase/common.h"
+#include "ccbase/rate_limiter.h"
+#include "ccbase/timer_wheel.h"
+
+namespace ccb {
+
+// KeyedRateLimiter keeps a limit per key, e.g. tenant id or client IP, with
+// the same rate and bucket size. Per-key states live in sharded linear
+// probing tables of 16-byte slots and are updated lazily on access.
+// Keys idle for ttl_ms are evicted by a periodic timer on timer_wheel which
+// sweeps one shard per sweep_period ticks. An evicted key comes back with
+// a full bucket. At most max_keys keys are tracked, requests of new keys are
+// rejected while the table is full of active keys.
+class KeyedRateLimiter {
+ public:
+  enum class Algorithm {
+    // milli-tokens refilled per ms, ttl_ms >= bucket_size / tokens_per_sec
+    // keeps limiting exact
+    kTokenBucket,
+    // a TAT of GcraConfig shared by all keys, exact rate and any bucket
+    // size, and idle time is counted from the TAT so eviction is exact
+    kGcra,
+  };
+
+  // of kTokenBucket
+  static constexpr uint32_t kMaxBucketSize = 4000000;
+
+  KeyedRateLimiter(uint32_t tokens_per_sec, uint32_t bucket_size,
+                   size_t max_keys, uint32_t ttl_ms,
+                   TimerWheel* timer_wheel = nullptr,
+                   tick_t sweep_period = 1000,
+                   size_t shards = 64,
+                   Algorithm algorithm = Algorithm::kTokenBucket);
+
+  // explicit tv_now should be of the time base of the monotonic clock
+  bool Get(uint64_t key, uint32_t need_tokens = 1,
+           const struct timeval* tv_now = nullptr);
+  bool Check(uint64_t key, uint32_t need_tokens,
+             const struct timeval* tv_now = nullptr);
+  // evict idle keys of all shards now
+  void Evict(const struct timeval* tv_now = nullptr);
+  size_t size() const;
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(KeyedRateLimiter);
+
+  struct Bucket {
+    uint32_t last_ms;       // time of last refill
+    uint32_t milli_tokens;  // 1/1000 token, refilled tokens_per_sec per ms
+  };
+  struct Slot {
+    uint64_t key;
+    union {
+      Bucket bucket;  // of kTokenBucket
+      uint64_t tat;   // of kGcra
+    };
+  };
+  static_assert(sizeof(Slot) == 16, "Slot should be compact");
+  struct Shard {
+    std::mutex mutex;
+    std::vector<Slot> slots;
+    size_t count = 0;
+    // key 0 marks empty slots so it is stored separately
+    bool has_zero_key = false;
+    Slot zero_key_slot;
+  };
+
+  // in ms of kTokenBucket or in time of GcraConfig
+  uint64_t Now(const struct timeval* tv_now = nullptr) const;
+  bool IsIdle(const Slot& slot, uint64_t now) const;
+  void KeepTat(Slot* slot, uint64_t now) const;
+  Shard& SelectShard(uint64_t hash) {
+    // slots are indexed by the low bits
+    return shards_[(hash >> 32) & (shard_count_ - 1)];
+  }
+  Slot* FindSlot(Shard* shard, uint64_t key, uint64_t hash);
+  Slot* InsertSlot(Shard* shard, uint64_t key, uint64_t hash, uint64_t now);
+  void Grow(Shard* shard);
+  void EraseSlot(Shard* shard, size_t pos);
+  void EvictShard(Shard* shard, const struct timeval* tv_now = nullptr);
+  void EvictShardInLock(Shard* shard, uint64_t now);
+  void Refill(Slot* slot, uint32_t now) const;
+
+  Algorithm algorithm_;
+  uint32_t tokens_per_sec_;
+  uint32_t max_milli_tokens_;
+  uint32_t ttl_ms_;
+  GcraConfig gcra_;
+  uint64_t gcra_ttl_;
+  size_t max_keys_;
+  size_t max_keys_per_shard_;
+  size_t max_slots_per_shard_;
+  std::unique_ptr<Shard[]> shards_;
+  size_t shard_count_;
+  size_t sweep_cursor_;
+  // inserting and evicting keys only, lookups do not touch it
+  std::atomic<size_t> key_count_;
+  MonotonicClock clock_;
+  uint64_t start_ns_;
+  TimerOwner sweep_timer_;
+};
+
+}  // namespace ccb
+
+#endif  // CCBASE_KEYED_RATE_LIMITER_H_
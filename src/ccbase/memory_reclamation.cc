@@ -0,0 +1,166 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ccbase/memory_reclamation.h"
+#include "ccbase/thread.h"
+
+namespace ccb {
+
+constexpr size_t ReclaimerService::kBatchSize;
+
+ReclaimerService::ReclaimerService(size_t max_backlog,
+                                   size_t poll_interval_us)
+    : max_backlog_(max_backlog),
+      poll_interval_us_(poll_interval_us),
+      backlog_(0),
+      submit_seq_(0),
+      completed_seq_(0),
+      stop_(false) {
+  thread_ = CreateThread("reclaimer", [this] { ServiceLoop(); });
+}
+
+ReclaimerService::~ReclaimerService() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  submit_cond_.notify_one();
+  thread_.join();
+  // jobs may be submitted by thread-local cleanup of the exiting thread
+  std::vector<Job> jobs;
+  jobs.swap(submitted_jobs_);
+  while (!jobs.empty()) {
+    Complete(RunJobs(&jobs), jobs);
+    if (!jobs.empty()) {
+      std::this_thread::sleep_for(std::chrono::microseconds(poll_interval_us_));
+    }
+  }
+}
+
+void ReclaimerService::Submit(size_t objects, ClosureFunc<bool()> job,
+                              bool wait) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // the reclaimer thread must not wait for itself
+  if (wait && !InServiceThread()) {
+    complete_cond_.wait(lock, [this, objects] {
+      size_t backlog = backlog_.load(std::memory_order_relaxed);
+      return backlog == 0 || backlog + objects <= max_backlog_;
+    });
+  }
+  backlog_.fetch_add(objects, std::memory_order_relaxed);
+  submitted_jobs_.push_back(Job{++submit_seq_, objects, std::move(job)});
+  if (submitted_jobs_.size() == 1) {
+    submit_cond_.notify_one();
+  }
+}
+
+void ReclaimerService::Flush() {
+  if (InServiceThread()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t ticket = submit_seq_;
+  complete_cond_.wait(lock, [this, ticket] {
+    return completed_seq_ >= ticket;
+  });
+}
+
+void ReclaimerService::ServiceLoop() {
+  std::vector<Job> jobs;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto pred = [this] { return stop_ || !submitted_jobs_.empty(); };
+      if (jobs.empty()) {
+        submit_cond_.wait(lock, pred);
+      } else {
+        submit_cond_.wait_for(lock,
+                              std::chrono::microseconds(poll_interval_us_),
+                              pred);
+      }
+      for (auto& job : submitted_jobs_) {
+        jobs.push_back(std::move(job));
+      }
+      submitted_jobs_.clear();
+      if (stop_ && jobs.empty()) {
+        break;
+      }
+    }
+    Complete(RunJobs(&jobs), jobs);
+  }
+}
+
+size_t ReclaimerService::RunJobs(std::vector<Job>* jobs) {
+  size_t completed = 0;
+  size_t pending = 0;
+  for (auto& job : *jobs) {
+    if (job.func()) {
+      completed += job.objects;
+    } else {
+      (*jobs)[pending++] = std::move(job);
+    }
+  }
+  jobs->resize(pending);
+  return completed;
+}
+
+void ReclaimerService::Complete(size_t objects,
+                                const std::vector<Job>& pending_jobs) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    backlog_.fetch_sub(objects, std::memory_order_relaxed);
+    // pending jobs are kept in submission order and precede the jobs
+    // not taken yet
+    uint64_t completed_seq = submit_seq_;
+    if (!pending_jobs.empty()) {
+      completed_seq = pending_jobs.front().seq - 1;
+    } else if (!submitted_jobs_.empty()) {
+      completed_seq = submitted_jobs_.front().seq - 1;
+    }
+    if (objects == 0 && completed_seq == completed_seq_) {
+      return;
+    }
+    completed_seq_ = completed_seq;
+  }
+  complete_cond_.notify_all();
+}
+
+bool ReclaimerService::InServiceThread() const {
+  return std::this_thread::get_id() == thread_.get_id();
+}
+
+void ReclaimerServiceSlot::Set(ReclaimerService* service) {
+  service_.store(service, std::memory_order_seq_cst);
+  // writers which have loaded the old service are counted in users_
+  while (users_.load(std::memory_order_seq_cst)) {
+    std::this_thread::yield();
+  }
+}
+
+}  // namespace ccb
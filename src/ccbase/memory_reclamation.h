@@ -31,8 +31,12 @@
 #define CCBASE_MEMORY_RECLAMATION_H_
 
 #include <assert.h>
+#include <stdint.h>
 #include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <utility>
 #include <algorithm>
@@ -81,15 +85,433 @@ class RefCountReclamation {
 };
 
 
+/* Retired pointer with its deleter
+ *
+ * The deleter is kept by type instead of in a ClosureFunc. It is stored in
+ * place when trivially copyable and no larger than a pointer, which covers
+ * std::default_delete, stateless functors, function pointers and lambdas
+ * capturing one reference, so only larger deleters allocate.
+ */
+template <class T>
+class RetiredPtr {
+ public:
+  RetiredPtr() = default;
+
+  RetiredPtr(T* ptr, std::nullptr_t)
+      : ptr_(ptr), reclaim_(&DefaultDelete) {}
+
+  template <class F>
+  RetiredPtr(T* ptr, F&& del_func)
+      : ptr_(ptr) {
+    using D = typename std::decay<F>::type;
+    SetDeleter<D>(std::forward<F>(del_func), InPlace<D>());
+  }
+
+  T* ptr() const {
+    return ptr_;
+  }
+
+  void Reclaim() {
+    reclaim_(ptr_, &storage_);
+  }
+
+ private:
+  using Storage = typename std::aligned_storage<sizeof(void*),
+                                                alignof(void*)>::type;
+  template <class D>
+  using InPlace = std::integral_constant<bool,
+      sizeof(D) <= sizeof(Storage) && alignof(D) <= alignof(Storage) &&
+      std::is_trivially_copyable<D>::value>;
+
+  template <class D, class F>
+  void SetDeleter(F&& del_func, std::true_type) {
+    new (&storage_) D(std::forward<F>(del_func));
+    reclaim_ = &InPlaceDelete<D>;
+  }
+
+  template <class D, class F>
+  void SetDeleter(F&& del_func, std::false_type) {
+    *reinterpret_cast<D**>(&storage_) = new D(std::forward<F>(del_func));
+    reclaim_ = &HeapDelete<D>;
+  }
+
+  static void DefaultDelete(T* ptr, Storage*) {
+    std::default_delete<T>()(ptr);
+  }
+
+  template <class D>
+  static void InPlaceDelete(T* ptr, Storage* storage) {
+    (*reinterpret_cast<D*>(storage))(ptr);
+  }
+
+  template <class D>
+  static void HeapDelete(T* ptr, Storage* storage) {
+    std::unique_ptr<D> del_func(*reinterpret_cast<D**>(storage));
+    (*del_func)(ptr);
+  }
+
+  T* ptr_;
+  void (*reclaim_)(T*, Storage*);
+  Storage storage_;
+};
+
+/* Chunk of retired entries and the per-thread pool caching free chunks
+ */
+template <class Entry>
+struct RetireChunk {
+  static constexpr size_t kCapacity = 64;
+
+  RetireChunk* next;
+  size_t begin;
+  size_t end;
+  Entry entries[kCapacity];
+};
+
+template <class Entry>
+class RetireChunkPool {
+ public:
+  RetireChunkPool() : free_list_(nullptr), free_count_(0) {}
+
+  ~RetireChunkPool() {
+    while (free_list_) {
+      RetireChunk<Entry>* chunk = free_list_;
+      free_list_ = chunk->next;
+      delete chunk;
+    }
+  }
+
+  RetireChunk<Entry>* Alloc() {
+    RetireChunk<Entry>* chunk = free_list_;
+    if (chunk) {
+      free_list_ = chunk->next;
+      free_count_--;
+    } else {
+      chunk = new RetireChunk<Entry>;
+    }
+    chunk->next = nullptr;
+    chunk->begin = chunk->end = 0;
+    return chunk;
+  }
+
+  void Free(RetireChunk<Entry>* chunk) {
+    if (free_count_ >= kMaxFreeChunks) {
+      delete chunk;
+      return;
+    }
+    chunk->next = free_list_;
+    free_list_ = chunk;
+    free_count_++;
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(RetireChunkPool);
+
+  static constexpr size_t kMaxFreeChunks = 8;
+
+  RetireChunk<Entry>* free_list_;
+  size_t free_count_;
+};
+
+/* Retire-list made of intrusively linked chunks
+ *
+ * Growing never moves entries and emptied chunks go back to the pool given
+ * by the owner thread, so a writer retiring at a steady rate does not touch
+ * the heap. Entries are reclaimed when removed from the list, and chunks are
+ * freed to heap if no pool is given (e.g. lists handed over to others).
+ */
+template <class Entry>
+class RetireList {
+ public:
+  explicit RetireList(RetireChunkPool<Entry>* pool = nullptr)
+      : pool_(pool), head_(nullptr), tail_(nullptr), size_(0) {}
+
+  ~RetireList() {
+    clear();
+  }
+
+  void set_chunk_pool(RetireChunkPool<Entry>* pool) {
+    pool_ = pool;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  Entry& front() {
+    return head_->entries[head_->begin];
+  }
+
+  template <class... Args>
+  void emplace_back(Args&&... args) {
+    if (!tail_ || tail_->end == Chunk::kCapacity) {
+      Chunk* chunk = AllocChunk();
+      if (tail_) {
+        tail_->next = chunk;
+      } else {
+        head_ = chunk;
+      }
+      tail_ = chunk;
+    }
+    new (&tail_->entries[tail_->end++]) Entry(std::forward<Args>(args)...);
+    size_++;
+  }
+
+  // reclaim the first entry
+  void pop_front() {
+    front().Reclaim();
+    size_--;
+    if (++head_->begin == head_->end) {
+      Chunk* chunk = head_;
+      head_ = chunk->next;
+      if (!head_) tail_ = nullptr;
+      FreeChunk(chunk);
+    }
+  }
+
+  // reclaim all entries
+  void clear() {
+    while (head_) {
+      Chunk* chunk = head_;
+      for (size_t i = chunk->begin; i < chunk->end; i++) {
+        chunk->entries[i].Reclaim();
+      }
+      head_ = chunk->next;
+      FreeChunk(chunk);
+    }
+    tail_ = nullptr;
+    size_ = 0;
+  }
+
+  // reclaim entries satisfying @pred and keep the order of others
+  template <class Pred>
+  void remove_if(Pred pred) {
+    if (!head_) return;
+    // survivors are compacted forward and never overtake the scanning
+    Chunk* wchunk = head_;
+    size_t windex = head_->begin;
+    for (Chunk* chunk = head_; chunk; chunk = chunk->next) {
+      for (size_t i = chunk->begin; i < chunk->end; i++) {
+        Entry& entry = chunk->entries[i];
+        if (pred(entry)) {
+          entry.Reclaim();
+          size_--;
+          continue;
+        }
+        if (windex == Chunk::kCapacity) {
+          wchunk->end = windex;
+          wchunk = wchunk->next;
+          wchunk->begin = windex = 0;
+        }
+        wchunk->entries[windex++] = entry;
+      }
+    }
+    wchunk->end = windex;
+    Chunk* unused = (size_ ? wchunk->next : head_);
+    if (size_) {
+      wchunk->next = nullptr;
+      tail_ = wchunk;
+    } else {
+      head_ = tail_ = nullptr;
+    }
+    while (unused) {
+      Chunk* chunk = unused;
+      unused = chunk->next;
+      FreeChunk(chunk);
+    }
+  }
+
+  // move all entries of @rlist to the end of this list
+  void splice(RetireList* rlist) {
+    if (rlist->empty()) return;
+    if (tail_) {
+      tail_->next = rlist->head_;
+    } else {
+      head_ = rlist->head_;
+    }
+    tail_ = rlist->tail_;
+    size_ += rlist->size_;
+    rlist->head_ = rlist->tail_ = nullptr;
+    rlist->size_ = 0;
+  }
+
+  // swap entries but not chunk pools
+  void swap(RetireList& rlist) {
+    std::swap(head_, rlist.head_);
+    std::swap(tail_, rlist.tail_);
+    std::swap(size_, rlist.size_);
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(RetireList);
+
+  using Chunk = RetireChunk<Entry>;
+
+  Chunk* AllocChunk() {
+    if (pool_) return pool_->Alloc();
+    Chunk* chunk = new Chunk;
+    chunk->next = nullptr;
+    chunk->begin = chunk->end = 0;
+    return chunk;
+  }
+
+  void FreeChunk(Chunk* chunk) {
+    if (pool_) {
+      pool_->Free(chunk);
+    } else {
+      delete chunk;
+    }
+  }
+
+  RetireChunkPool<Entry>* pool_;
+  Chunk* head_;
+  Chunk* tail_;
+  size_t size_;
+};
+
+
+/* Background reclaimer shared by reclamation policies
+ *
+ * Writers hand batches of retired objects over as jobs, then the reclaimer
+ * thread runs every job until it reports all of its objects freed. Backlog
+ * is the number of objects held by unfinished jobs and Submit blocks while
+ * it would exceed max_backlog, so a writer outrunning the reclaimer is slowed
+ * down instead of piling up memory. A writer which may pin retired objects
+ * itself (i.e. retires inside a read-side section) must not wait, the
+ * backlog is then allowed to overflow.
+ */
+class ReclaimerService {
+ public:
+  // objects retired by one writer are handed over in batches of this size
+  static constexpr size_t kBatchSize = 64;
+
+  explicit ReclaimerService(size_t max_backlog = 65536,
+                            size_t poll_interval_us = 1000);
+  // complete all submitted jobs before return
+  ~ReclaimerService();
+
+  /* Submit a reclamation job
+   * @objects   number of objects held by the job
+   * @job       frees what it can and returns true if nothing is left,
+   *            or false to be retried after poll_interval_us
+   * @wait      false to submit without waiting for backlog, required if
+   *            the caller may be what keeps pending jobs from completing
+   */
+  void Submit(size_t objects, ClosureFunc<bool()> job, bool wait = true);
+
+  /* Wait until all jobs submitted before by any thread have been completed
+   *
+   * Jobs submitted after the call are not waited for. It must not be called
+   * inside a read-side section, which may keep the jobs from completing.
+   */
+  void Flush();
+
+  size_t backlog() const {
+    return backlog_.load(std::memory_order_relaxed);
+  }
+
+  /* Read-side sections the calling thread is in, of any policy
+   *
+   * A pending job may wait for any of them, even of another domain on the
+   * same service, so a writer inside one submits without waiting. Policies
+   * handing over to services keep it in their ReadLock and ReadUnlock.
+   */
+  static size_t& LocalReadSections() {
+    static thread_local size_t sections = 0;
+    return sections;
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(ReclaimerService);
+
+  struct Job {
+    uint64_t seq;
+    size_t objects;
+    ClosureFunc<bool()> func;
+  };
+
+  void ServiceLoop();
+  size_t RunJobs(std::vector<Job>* jobs);
+  void Complete(size_t objects, const std::vector<Job>& pending_jobs);
+  bool InServiceThread() const;
+
+  const size_t max_backlog_;
+  const size_t poll_interval_us_;
+  std::mutex mutex_;
+  std::condition_variable submit_cond_;
+  std::condition_variable complete_cond_;
+  std::vector<Job> submitted_jobs_;
+  std::atomic<size_t> backlog_;
+  // jobs are numbered in submission order, all jobs up to completed_seq_
+  // have been completed
+  uint64_t submit_seq_;
+  uint64_t completed_seq_;
+  bool stop_;
+  std::thread thread_;
+};
+
+/* The service used by a reclamation policy
+ *
+ * Writers reach the service only inside Use, and Set waits for the writers
+ * still using the old one, so it may be destroyed once Set has returned.
+ */
+class ReclaimerServiceSlot {
+ public:
+  constexpr ReclaimerServiceSlot() : service_(nullptr), users_(0) {}
+
+  bool is_set() const {
+    return service_.load(std::memory_order_relaxed) != nullptr;
+  }
+
+  void Set(ReclaimerService* service);
+
+  // call func with the service and return true if it is set
+  template <class F>
+  bool Use(F&& func) {
+    // pairs with Set: either we see the new service or it sees us
+    users_.fetch_add(1, std::memory_order_seq_cst);
+    UseGuard guard(&users_);
+    ReclaimerService* service = service_.load(std::memory_order_seq_cst);
+    if (service) {
+      func(service);
+    }
+    return service != nullptr;
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(ReclaimerServiceSlot);
+
+  struct UseGuard {
+    explicit UseGuard(std::atomic<size_t>* users) : users(users) {}
+    ~UseGuard() {
+      users->fetch_sub(1, std::memory_order_release);
+    }
+    std::atomic<size_t>* users;
+  };
+
+  std::atomic<ReclaimerService*> service_;
+  std::atomic<size_t> users_;
+};
+
+
 /* Epoch based memory relcamation
+ *
+ * Advancing the epoch has to check all threads, so a writer tries it once
+ * per kEpochUpdateInterval retires rather than in every Retire.
  */
-template <class T, class ScopeT = T>
+template <class T, class ScopeT = T, size_t kEpochUpdateInterval = 32>
 class EpochBasedReclamation {
  public:
   EpochBasedReclamation() = default;
 
   static void ReadLock() {
     ReaderThreadState* state = &state_list_.LocalNode()->reader_state;
+    if (!state->is_active.load(std::memory_order_relaxed)) {
+      ReclaimerService::LocalReadSections()++;
+    }
     state->is_active.store(true, std::memory_order_relaxed);
     state->local_epoch.store(global_epoch_.load(std::memory_order_relaxed),
                              std::memory_order_relaxed);
@@ -100,6 +522,9 @@ class EpochBasedReclamation {
 
   static void ReadUnlock() {
     ReaderThreadState* state = &state_list_.LocalNode()->reader_state;
+    if (state->is_active.load(std::memory_order_relaxed)) {
+      ReclaimerService::LocalReadSections()--;
+    }
     // memory_order_release is required when leaving cirtical-section
     state->is_active.store(false, std::memory_order_release);
   }
@@ -129,14 +554,49 @@ class EpochBasedReclamation {
     //   so always have reader-epoch <= N
     // - if global-epoch is at least N all current and future readers live in
     //   epoch >= N-1
+    // - TryReclaim must be called in every Retire to keep retire_epoch
+    //   up to date, it is cheap unless there are objects to reclaim
     TryReclaim();
     WriterThreadState* writer_state = &state_list_.LocalNode()->writer_state;
+    if (reclaimer_.is_set()) {
+      writer_state->handover_list.emplace_back(ptr, std::forward<F>(del_func));
+      if (writer_state->handover_list.size() >= ReclaimerService::kBatchSize) {
+        HandOver(writer_state);
+      }
+      return;
+    }
+    if (!writer_state->handover_list.empty()) {
+      HandOver(writer_state);
+    }
     writer_state->retire_lists[writer_state->retire_epoch % kEpochSlots]
                  .emplace_back(ptr, std::forward<F>(del_func));
-    TryUpdateEpoch();
+    if (++writer_state->retire_count % kEpochUpdateInterval == 0) {
+      TryUpdateEpoch();
+    }
+  }
+
+  /* Reclaim retired objects in a background reclaimer
+   * @reclaimer   the service shared by writers, nullptr to reclaim in
+   *              writer threads as default
+   *
+   * Writers then only batch retired objects, while advancing epoch and
+   * freeing is done by the reclaimer thread. The service must be reset to
+   * nullptr before it is destroyed, which waits for writers still handing
+   * over to it. Retire inside a read-side section of any policy never waits
+   * for the service, but RetireCleanup must not be called there.
+   */
+  static void SetReclaimerService(ReclaimerService* reclaimer) {
+    reclaimer_.Set(reclaimer);
   }
 
   static void RetireCleanup() {
+    WriterThreadState* writer_state = &state_list_.LocalNode()->writer_state;
+    if (!writer_state->handover_list.empty()) {
+      HandOver(writer_state);
+    }
+    reclaimer_.Use([](ReclaimerService* reclaimer) {
+      reclaimer->Flush();
+    });
     for (size_t count = 0; count < kEpochSlots; ) {
       count += TryReclaim();
       TryUpdateEpoch();
@@ -151,6 +611,8 @@ class EpochBasedReclamation {
  private:
   CCB_NOT_COPYABLE_AND_MOVABLE(EpochBasedReclamation);
 
+  struct WriterThreadState;
+
   static size_t TryReclaim() {
     WriterThreadState* writer_state = &state_list_.LocalNode()->writer_state;
     uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
@@ -170,6 +632,35 @@ class EpochBasedReclamation {
     return 0;
   }
 
+  static void HandOver(WriterThreadState* writer_state) {
+    bool handed_over = reclaimer_.Use([=](ReclaimerService* reclaimer) {
+      auto batch = std::make_shared<RetireList<RetireEntry>>();
+      batch->swap(writer_state->handover_list);
+      // all objects in the batch were unreachable before loading the epoch,
+      // so they are retired in this epoch at the latest
+      uint64_t retire_epoch = global_epoch_.load(std::memory_order_seq_cst);
+      // a writer in a read-side section may hold the epoch back, so waiting
+      // for the backlog to drop would never return
+      bool wait = (ReclaimerService::LocalReadSections() == 0);
+      reclaimer->Submit(batch->size(), [batch, retire_epoch] {
+        TryUpdateEpoch();
+        if (global_epoch_.load(std::memory_order_seq_cst) <
+                retire_epoch + 2) {
+          return false;
+        }
+        batch->clear();
+        return true;
+      }, wait);
+    });
+    if (!handed_over) {
+      // service has been reset, keep the batch in current retire-list which
+      // is never reclaimed earlier than the batch would be
+      TryReclaim();
+      writer_state->retire_lists[writer_state->retire_epoch % kEpochSlots]
+                   .splice(&writer_state->handover_list);
+    }
+  }
+
   static void TryUpdateEpoch() {
     // safety proof:
     // - if any reader's ReadLock-store-fence happens before the load below,
@@ -208,42 +699,30 @@ class EpochBasedReclamation {
   };
 
   // writer state
-  struct RetireEntry {
-    T* ptr;
-    ClosureFunc<void(T*)> del_func;
-
-    RetireEntry(T* p, ClosureFunc<void(T*)> f)
-        : ptr(p), del_func(std::move(f)) {}
-    RetireEntry(const RetireEntry&) = delete;
-    RetireEntry(RetireEntry&& e) {
-      // move may happen when retire_list.emplace_back
-      ptr = e.ptr;
-      e.ptr = nullptr;
-      del_func = std::move(e.del_func);
-    }
-    void operator=(const RetireEntry&) = delete;
-    void operator=(RetireEntry&&) = delete;
-    ~RetireEntry() {
-      if (ptr) {
-        if (del_func)
-          del_func(ptr);
-        else
-          std::default_delete<T>()(ptr);
-      }
-    }
-  };
+  using RetireEntry = RetiredPtr<T>;
 
   static constexpr size_t kEpochSlots = 2;  // only need 2 in this impl
 
   struct WriterThreadState {
     uint64_t retire_epoch{0};
-    std::vector<RetireEntry> retire_lists[kEpochSlots];
+    size_t retire_count{0};
+    RetireChunkPool<RetireEntry> chunk_pool;
+    RetireList<RetireEntry> retire_lists[kEpochSlots];
+    RetireList<RetireEntry> handover_list;
+
+    WriterThreadState() {
+      for (auto& rlist : retire_lists) {
+        rlist.set_chunk_pool(&chunk_pool);
+      }
+      handover_list.set_chunk_pool(&chunk_pool);
+    }
 
     ~WriterThreadState() {
       // do cleanup if we have retired pointers not reclaimed
-      if (std::any_of(retire_lists, retire_lists + kEpochSlots,
-                      [](const std::vector<RetireEntry>& v) {
-                        return !v.empty();
+      if (!handover_list.empty() ||
+          std::any_of(retire_lists, retire_lists + kEpochSlots,
+                      [](const RetireList<RetireEntry>& rlist) {
+                        return !rlist.empty();
                       })) {
         RetireCleanup();
       }
@@ -258,15 +737,22 @@ class EpochBasedReclamation {
 
   // static member variables
   static std::atomic<uint64_t> global_epoch_;
+  static ReclaimerServiceSlot reclaimer_;
   static ThreadLocalList<ThreadState> state_list_;
 };
 
-template <class T, class ScopeT>
-std::atomic<uint64_t> EpochBasedReclamation<T, ScopeT>::global_epoch_{0};
+template <class T, class ScopeT, size_t kEpochUpdateInterval>
+std::atomic<uint64_t>
+EpochBasedReclamation<T, ScopeT, kEpochUpdateInterval>::global_epoch_{0};
+
+template <class T, class ScopeT, size_t kEpochUpdateInterval>
+ReclaimerServiceSlot
+EpochBasedReclamation<T, ScopeT, kEpochUpdateInterval>::reclaimer_;
 
-template <class T, class ScopeT>
-ThreadLocalList<typename EpochBasedReclamation<T, ScopeT>::ThreadState>
-EpochBasedReclamation<T, ScopeT>::state_list_;
+template <class T, class ScopeT, size_t kEpochUpdateInterval>
+ThreadLocalList<typename EpochBasedReclamation<T, ScopeT,
+    kEpochUpdateInterval>::ThreadState>
+EpochBasedReclamation<T, ScopeT, kEpochUpdateInterval>::state_list_;
 
 
 /* Hazard pointer based memory relcamation
@@ -281,6 +767,10 @@ class HazardPtrReclamation {
   static void ReadLock(T* ptr, size_t index = 0) {
     assert(index < kHazardPtrNum);
     ReaderThreadState* state = &state_list_.LocalNode()->reader_state;
+    // every hazard pointer held counts as a read-side section
+    ReclaimerService::LocalReadSections() +=
+        static_cast<size_t>(ptr != nullptr) -
+        (state->hazard_ptrs[index].load(std::memory_order_relaxed) != nullptr);
     // memory_order_seq_cst is required to garentee that hazard pointer
     // is visable to all threads before critical-section
     state->hazard_ptrs[index].store(ptr, std::memory_order_seq_cst);
@@ -289,6 +779,9 @@ class HazardPtrReclamation {
   static void ReadUnlock() {
     ReaderThreadState* state = &state_list_.LocalNode()->reader_state;
     for (auto& hp : state->hazard_ptrs) {
+      if (hp.load(std::memory_order_relaxed)) {
+        ReclaimerService::LocalReadSections()--;
+      }
       // memory_order_release is required when leaving cirtical-section
       hp.store(nullptr, std::memory_order_release);
     }
@@ -316,12 +809,40 @@ class HazardPtrReclamation {
     WriterThreadState* writer_state = &state_list_.LocalNode()->writer_state;
     writer_state->retire_list.emplace_back(ptr, std::forward<F>(del_func));
     if (writer_state->retire_list.size() >= kReclaimThreshold) {
-      TryReclaim();
+      if (!reclaimer_.is_set()) {
+        TryReclaim();
+      } else if (writer_state->retire_list.size() >= kHandOverThreshold &&
+                 !reclaimer_.Use([=](ReclaimerService* reclaimer) {
+                   HandOver(reclaimer, writer_state);
+                 })) {
+        // service has just been reset
+        TryReclaim();
+      }
     }
   }
 
+  /* Reclaim retired objects in a background reclaimer
+   * @reclaimer   the service shared by writers, nullptr to reclaim in
+   *              writer threads as default
+   *
+   * Writers then hand full retire-lists over, while scanning hazard pointers
+   * and freeing is done by the reclaimer thread. The service must be reset
+   * to nullptr before it is destroyed, which waits for writers still handing
+   * over to it. Retire inside a read-side section of any policy never waits
+   * for the service, but RetireCleanup must not be called there.
+   */
+  static void SetReclaimerService(ReclaimerService* reclaimer) {
+    reclaimer_.Set(reclaimer);
+  }
+
   static void RetireCleanup() {
     WriterThreadState* writer_state = &state_list_.LocalNode()->writer_state;
+    reclaimer_.Use([=](ReclaimerService* reclaimer) {
+      if (!writer_state->retire_list.empty()) {
+        HandOver(reclaimer, writer_state);
+      }
+      reclaimer->Flush();
+    });
     while (!writer_state->retire_list.empty()) {
       TryReclaim();
     }
@@ -335,7 +856,14 @@ class HazardPtrReclamation {
  private:
   CCB_NOT_COPYABLE_AND_MOVABLE(HazardPtrReclamation);
 
+  using RetireEntry = RetiredPtr<T>;
+  struct WriterThreadState;
+
   static void TryReclaim() {
+    TryReclaim(&state_list_.LocalNode()->writer_state.retire_list);
+  }
+
+  static void TryReclaim(RetireList<RetireEntry>* rlist) {
     // safety proof:
     // - if we decide one pointer can't be reclaimed it's always safe
     // - if we decide one pointer can be reclaimed let's consider one reader:
@@ -361,17 +889,24 @@ class HazardPtrReclamation {
       }
     });
     std::sort(hazard_ptr_vec.begin(), hazard_ptr_vec.end());
-    // filter out hazard pointers (survivors) from retire list
-    WriterThreadState* writer_state = &state_list_.LocalNode()->writer_state;
-    size_t survivors = 0;
-    for (auto& entry : writer_state->retire_list) {
-      if (std::binary_search(hazard_ptr_vec.begin(),
-                             hazard_ptr_vec.end(), entry.ptr)) {
-        writer_state->retire_list[survivors++].swap(entry);
-      }
-    }
-    // reclaim all entries except survivors
-    writer_state->retire_list.resize(survivors);
+    // reclaim all entries except hazard pointers (survivors)
+    rlist->remove_if([](const RetireEntry& entry) {
+      return !std::binary_search(hazard_ptr_vec.begin(),
+                                 hazard_ptr_vec.end(), entry.ptr());
+    });
+  }
+
+  static void HandOver(ReclaimerService* reclaimer,
+                       WriterThreadState* writer_state) {
+    auto batch = std::make_shared<RetireList<RetireEntry>>();
+    batch->swap(writer_state->retire_list);
+    // a hazard pointer held by the writer may pin pending objects, so
+    // waiting for the backlog to drop would never return
+    bool wait = (ReclaimerService::LocalReadSections() == 0);
+    reclaimer->Submit(batch->size(), [batch] {
+      TryReclaim(batch.get());
+      return batch->empty();
+    }, wait);
   }
 
   // reader state
@@ -379,44 +914,11 @@ class HazardPtrReclamation {
     std::atomic<T*> hazard_ptrs[kHazardPtrNum];
   };
 
-  // writer state
-  struct RetireEntry {
-    T* ptr;
-    ClosureFunc<void(T*)> del_func;
-
-    RetireEntry()
-        : ptr(nullptr), del_func(nullptr) {
-      assert(false);  // never called
-    }
-    RetireEntry(T* p, ClosureFunc<void(T*)> f)
-        : ptr(p), del_func(std::move(f)) {}
-    RetireEntry(const RetireEntry&) = delete;
-    RetireEntry(RetireEntry&& e) {
-      // move may happen when retire_list.emplace_back
-      ptr = e.ptr;
-      e.ptr = nullptr;
-      del_func = std::move(e.del_func);
-    }
-    void operator=(const RetireEntry&) = delete;
-    void operator=(RetireEntry&& e) = delete;
-    void swap(RetireEntry& e) {
-      if (this != &e) {
-        std::swap(this->ptr, e.ptr);
-        this->del_func.swap(e.del_func);
-      }
-    }
-    ~RetireEntry() {
-      if (ptr) {
-        if (del_func)
-          del_func(ptr);
-        else
-          std::default_delete<T>()(ptr);
-      }
-    }
-  };
 
+  // writer state
   struct WriterThreadState {
-    std::vector<RetireEntry> retire_list;
+    RetireChunkPool<RetireEntry> chunk_pool;
+    RetireList<RetireEntry> retire_list{&chunk_pool};
 
     ~WriterThreadState() {
       // do cleanup if we have retired pointers not reclaimed
@@ -432,10 +934,23 @@ class HazardPtrReclamation {
     WriterThreadState writer_state;
   };
 
+  // hand-over costs a job allocation so don't do it for short lists
+  static constexpr size_t kHandOverThreshold =
+      kReclaimThreshold > ReclaimerService::kBatchSize ?
+          kReclaimThreshold : ReclaimerService::kBatchSize;
+
   // static member variables
+  static ReclaimerServiceSlot reclaimer_;
   static ThreadLocalList<ThreadState> state_list_;
 };
 
+template <class T, class ScopeT,
+          size_t kHazardPtrNum,
+          size_t kReclaimThreshold>
+ReclaimerServiceSlot
+HazardPtrReclamation<T, ScopeT, kHazardPtrNum,
+    kReclaimThreshold>::reclaimer_;
+
 template <class T, class ScopeT,
           size_t kHazardPtrNum,
           size_t kReclaimThreshold>
@@ -445,6 +960,271 @@ HazardPtrReclamation<T, ScopeT, kHazardPtrNum,
     kReclaimThreshold>::state_list_;
 
 
+/* Registry of threads reading under QSBRReclamation
+ *
+ * It is shared by all QSBRReclamation instances so a thread announces its
+ * quiescent states once for all of them. A thread is registered by its first
+ * ReadLock and then blocks reclamation until it announces a quiescent state,
+ * so a registered thread should either announce periodically or go offline
+ * before blocking. WorkerGroup and WorkerPool workers do it automatically.
+ */
+class QSBRDomain {
+ public:
+  // announce that no reference is held by the calling thread
+  static void QuiescentState() {
+    ThreadState* state = LocalStatePtr();
+    if (state) {
+      state->quiescent_epoch.store(
+          global_epoch().load(std::memory_order_acquire),
+          std::memory_order_release);
+    }
+  }
+
+  // an offline thread holds no reference and is ignored by writers
+  static void Offline() {
+    ThreadState* state = LocalStatePtr();
+    if (state) {
+      state->is_online.store(false, std::memory_order_release);
+    }
+  }
+
+  static void Online() {
+    ThreadState* state = LocalStatePtr();
+    if (state) {
+      state->is_online.store(true, std::memory_order_relaxed);
+      // pairs with the seq_cst epoch update and is_online load in writers:
+      // either we are seen online or we see the unlinking below
+      atomic_thread_fence(std::memory_order_seq_cst);
+      state->quiescent_epoch.store(
+          global_epoch().load(std::memory_order_acquire),
+          std::memory_order_release);
+    }
+  }
+
+  static bool IsRegistered() {
+    return LocalStatePtr() != nullptr;
+  }
+
+  static void Register() {
+    ThreadState*& state = LocalStatePtr();
+    if (!state) {
+      state = ThreadLocalList<ThreadState, QSBRDomain>().LocalNode();
+      // the node may be reused from an exited thread and constructed with
+      // plain stores, so publish the state before the first pointer load
+      // as Online does: either writers see us online with nothing announced
+      // or we see the unlinking
+      state->is_online.store(true, std::memory_order_relaxed);
+      state->quiescent_epoch.store(0, std::memory_order_relaxed);
+      atomic_thread_fence(std::memory_order_seq_cst);
+    }
+  }
+
+  // epoch to be passed by all online threads before reclaiming the objects
+  // unlinked before this call
+  static uint64_t AdvanceEpoch() {
+    return global_epoch().fetch_add(1, std::memory_order_seq_cst) + 1;
+  }
+
+  // objects unlinked before this call can be reclaimed once all online
+  // threads have passed the returned epoch + 1
+  static uint64_t CurrentEpoch() {
+    return global_epoch().load(std::memory_order_seq_cst);
+  }
+
+  // the least epoch announced by online threads
+  static uint64_t MinQuiescentEpoch() {
+    uint64_t min_epoch = UINT64_MAX;
+    ThreadLocalList<ThreadState, QSBRDomain>().Travel(
+        [&min_epoch](ThreadState* state) {
+      if (state->is_online.load(std::memory_order_seq_cst)) {
+        min_epoch = std::min(min_epoch, state->quiescent_epoch.load(
+                                            std::memory_order_acquire));
+      }
+    });
+    return min_epoch;
+  }
+
+ private:
+  struct ThreadState {
+    std::atomic<bool> is_online;
+    std::atomic<uint64_t> quiescent_epoch;
+
+    // no quiescent state announced yet
+    ThreadState() : is_online(true), quiescent_epoch(0) {}
+  };
+
+  static ThreadState*& LocalStatePtr() {
+    static thread_local ThreadState* tls_state = nullptr;
+    return tls_state;
+  }
+
+  static std::atomic<uint64_t>& global_epoch() {
+    static std::atomic<uint64_t> epoch{1};
+    return epoch;
+  }
+};
+
+
+/* Quiescent-state-based memory relcamation
+ *
+ * Readers pay nothing but registration in ReadLock. An object retired is
+ * reclaimed after all online registered threads have announced a quiescent
+ * state by QSBRDomain::QuiescentState() since it was retired. Read-side
+ * critical sections must not span a quiescent state or going offline.
+ *
+ * Retire only stamps the object with the next epoch, a writer advances the
+ * global epoch and scans the threads once per kEpochUpdateInterval retires.
+ */
+template <class T, class ScopeT = T, size_t kEpochUpdateInterval = 32>
+class QSBRReclamation {
+ public:
+  QSBRReclamation() = default;
+
+  static void ReadLock() {
+    QSBRDomain::Register();
+  }
+
+  static void ReadUnlock() {
+  }
+
+  static void Retire(T* ptr) {
+    Retire(ptr, nullptr);
+  }
+
+  static void Retire(T* ptr, std::default_delete<T>) {
+    Retire(ptr, nullptr);
+  }
+
+  /* Retire a pointer with user defined deletor
+   * @ptr       pointer to the object to be retired
+   * @del_func  deletor called when the retired object is reclaimed
+   *
+   * IMPORTANT: caller must garantee @ptr has been consistently unreachable to
+   * all threads (e.g. reset with memory_order_seq_cst)
+   */
+  template <class F>
+  static void Retire(T* ptr, F&& del_func) {
+    WriterThreadState* writer_state = &state_list_.LocalNode()->writer_state;
+    // reclaimable once the epoch has been advanced after this point and
+    // passed by all online threads
+    writer_state->retire_list.emplace_back(
+        QSBRDomain::CurrentEpoch() + 1,
+        RetiredPtr<T>(ptr, std::forward<F>(del_func)));
+    if (++writer_state->retire_count % kEpochUpdateInterval == 0) {
+      QSBRDomain::AdvanceEpoch();
+      TryReclaim();
+    }
+  }
+
+  /* Wait until all objects retired by the calling thread are reclaimed
+   *
+   * Caller should be out of any read-side critical section. Unlike EBR it
+   * waits for every online registered thread, not only for active readers,
+   * so it does not return while any thread that has ever called ReadLock is
+   * blocked (e.g. in join) without going offline.
+   */
+  static void RetireCleanup() {
+    QSBRDomain::AdvanceEpoch();
+    QSBRDomain::QuiescentState();
+    WriterThreadState* writer_state = &state_list_.LocalNode()->writer_state;
+    while (TryReclaim(), !writer_state->retire_list.empty() ||
+                         orphan_count_.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+
+  struct Trait {
+    using ReadLockPointer = std::false_type;
+    using HasRetireCleanup = std::true_type;
+  };
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(QSBRReclamation);
+
+  static void TryReclaim() {
+    WriterThreadState* writer_state = &state_list_.LocalNode()->writer_state;
+    auto& rlist = writer_state->retire_list;
+    bool has_orphans = orphan_count_.load(std::memory_order_acquire);
+    if (rlist.empty() && !has_orphans) {
+      return;
+    }
+    if (!has_orphans &&
+        rlist.front().epoch > QSBRDomain::CurrentEpoch()) {
+      // no thread can have passed the epoch yet, skip the scan
+      return;
+    }
+    uint64_t epoch = QSBRDomain::MinQuiescentEpoch();
+    // entries are in order of epoch
+    while (!rlist.empty() && rlist.front().epoch <= epoch) {
+      rlist.pop_front();
+    }
+    if (has_orphans) {
+      std::lock_guard<std::mutex> lock(orphan_mutex_);
+      orphan_list_.remove_if([epoch](const RetireEntry& entry) {
+        return entry.epoch <= epoch;
+      });
+      orphan_count_.store(orphan_list_.size(), std::memory_order_release);
+    }
+  }
+
+  struct RetireEntry {
+    uint64_t epoch;
+    RetiredPtr<T> retired;
+
+    RetireEntry() = default;
+    RetireEntry(uint64_t e, RetiredPtr<T> r) : epoch(e), retired(r) {}
+    void Reclaim() {
+      retired.Reclaim();
+    }
+  };
+
+  struct WriterThreadState {
+    size_t retire_count{0};
+    RetireChunkPool<RetireEntry> chunk_pool;
+    RetireList<RetireEntry> retire_list{&chunk_pool};
+
+    ~WriterThreadState() {
+      // waiting for others may deadlock at thread exit, so hand over the
+      // retired pointers not reclaimed to other writers
+      if (!retire_list.empty()) {
+        std::lock_guard<std::mutex> lock(orphan_mutex_);
+        orphan_list_.splice(&retire_list);
+        orphan_count_.store(orphan_list_.size(), std::memory_order_release);
+      }
+    }
+  };
+
+  // thread local state
+  struct ThreadState {
+    WriterThreadState writer_state;
+  };
+
+
+  // static member variables
+  static ThreadLocalList<ThreadState> state_list_;
+  static std::mutex orphan_mutex_;
+  static RetireList<RetireEntry> orphan_list_;
+  static std::atomic<size_t> orphan_count_;
+};
+
+template <class T, class ScopeT, size_t kEpochUpdateInterval>
+ThreadLocalList<typename QSBRReclamation<T, ScopeT,
+    kEpochUpdateInterval>::ThreadState>
+QSBRReclamation<T, ScopeT, kEpochUpdateInterval>::state_list_;
+
+template <class T, class ScopeT, size_t kEpochUpdateInterval>
+std::mutex QSBRReclamation<T, ScopeT, kEpochUpdateInterval>::orphan_mutex_;
+
+template <class T, class ScopeT, size_t kEpochUpdateInterval>
+RetireList<typename QSBRReclamation<T, ScopeT,
+    kEpochUpdateInterval>::RetireEntry>
+QSBRReclamation<T, ScopeT, kEpochUpdateInterval>::orphan_list_;
+
+template <class T, class ScopeT, size_t kEpochUpdateInterval>
+std::atomic<size_t>
+QSBRReclamation<T, ScopeT, kEpochUpdateInterval>::orphan_count_{0};
+
+
 /* An adapter class for single pointer reclamation
  */
 template <class T, class Reclamation>
@@ -0,0 +1,164 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <stdexcept>
+#include "ccbase/rate_limiter.h"
+
+#define TV2NS(ptv) ((ptv)->tv_sec * 1000000000UL + (ptv)->tv_usec * 1000UL)
+
+namespace ccb {
+
+constexpr unsigned GcraConfig::kFracBits;
+constexpr uint64_t GcraConfig::kMaxIdle;
+constexpr uint64_t GcraConfig::kMaxWait;
+
+GcraConfig::GcraConfig(uint32_t tokens_per_sec, uint32_t bucket_size,
+                       ClockSource clock_source)
+    : clock_source_(clock_source) {
+  Mod(tokens_per_sec, bucket_size);
+}
+
+void GcraConfig::Mod(uint32_t tokens_per_sec, uint32_t bucket_size) {
+  if (tokens_per_sec == 0) {
+    throw std::invalid_argument("GcraConfig: zero rate");
+  }
+  emission_ = ((1000000000UL << kFracBits) + tokens_per_sec / 2) /
+              tokens_per_sec;
+  max_need_ = (bucket_size ? bucket_size : 1);
+  // a huge bucket of a low rate is as good as a bucket of kMaxWait
+  max_need_ = static_cast<uint32_t>(
+      std::min<uint64_t>(max_need_, kMaxWait / emission_));
+  tolerance_ = max_need_ * emission_;
+}
+
+uint64_t GcraConfig::Now(const struct timeval* tv_now) const {
+  uint64_t ns_now = (tv_now ? TV2NS(tv_now)
+                            : MonotonicClock::NowNs(clock_source_));
+  return ns_now << kFracBits;
+}
+
+int GcraConfig::Overdraft(uint64_t* tat, uint64_t now,
+                          uint32_t need_tokens) const {
+  uint64_t wait = Wait(*tat, now) + std::min<uint64_t>(
+      need_tokens, kMaxWait / emission_) * emission_;
+  wait = std::min(wait, kMaxWait);
+  *tat = now + wait;
+  if (wait <= tolerance_) {
+    return 0;
+  }
+  return static_cast<int>((wait - tolerance_ + emission_ - 1) / emission_);
+}
+
+uint32_t GcraConfig::tokens(uint64_t tat, uint64_t now) const {
+  uint64_t wait = Wait(tat, now);
+  if (wait > tolerance_) {
+    // in debt after Overdraft()
+    return 0;
+  }
+  return static_cast<uint32_t>((tolerance_ - wait) / emission_);
+}
+
+GcraRateLimiter::GcraRateLimiter(uint32_t tokens_per_sec,
+                                 uint32_t bucket_size,
+                                 ClockSource clock_source)
+    : config_(tokens_per_sec, bucket_size, clock_source),
+      now_(config_.Now()),
+      tat_(now_) {
+}
+
+void GcraRateLimiter::Gen(const struct timeval* tv_now) {
+  uint64_t now = config_.Now(tv_now);
+  if (static_cast<int64_t>(now - now_) < 0) {
+    // the time went back, keep what is left to wait
+    tat_ += now - now_;
+  }
+  now_ = now;
+  // keep an idle TAT from wrapping
+  uint64_t idle = now_ - tat_;
+  if (idle > GcraConfig::kMaxIdle / 2 && idle < GcraConfig::kMaxIdle) {
+    tat_ = now_ - GcraConfig::kMaxIdle / 2;
+  }
+}
+
+SlidingWindowRateLimiter::SlidingWindowRateLimiter(uint32_t limit,
+                                                   uint32_t window_ms,
+                                                   uint32_t slots,
+                                                   ClockSource clock_source)
+    : clock_(clock_source),
+      limit_(limit),
+      total_(0) {
+  if (window_ms == 0 || slots == 0) {
+    throw std::invalid_argument("SlidingWindowRateLimiter: empty window");
+  }
+  // round up so the window of all slots is never shorter than window_ms
+  slot_ns_ = (window_ms * 1000000UL + slots - 1) / slots;
+  counts_.resize(slots + 1, 0);
+  cur_slot_index_ = clock_.NowNs() / slot_ns_;
+}
+
+void SlidingWindowRateLimiter::Gen(const struct timeval* tv_now) {
+  uint64_t ns_now = (tv_now ? TV2NS(tv_now) : clock_.NowNs());
+  Advance(ns_now / slot_ns_);
+}
+
+void SlidingWindowRateLimiter::Advance(uint64_t slot_index) {
+  if (slot_index < cur_slot_index_) {
+    // the time went back, move the window with the counts so that the
+    // tokens taken still expire a window after they were taken
+    size_t shift = (cur_slot_index_ - slot_index) % counts_.size();
+    std::rotate(counts_.begin(), counts_.begin() + shift, counts_.end());
+    cur_slot_index_ = slot_index;
+    return;
+  }
+  if (slot_index - cur_slot_index_ >= counts_.size()) {
+    // all slots expired
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_ = 0;
+    cur_slot_index_ = slot_index;
+    return;
+  }
+  while (cur_slot_index_ < slot_index) {
+    uint32_t& count = counts_[++cur_slot_index_ % counts_.size()];
+    total_ -= count;
+    count = 0;
+  }
+}
+
+uint32_t SlidingWindowRateLimiter::tokens() const {
+  return static_cast<uint32_t>(total_ < limit_ ? limit_ - total_ : 0);
+}
+
+int SlidingWindowRateLimiter::Overdraft(uint32_t need_tokens) {
+  counts_[cur_slot_index_ % counts_.size()] += need_tokens;
+  total_ += need_tokens;
+  return static_cast<int>(total_ > limit_ ? total_ - limit_ : 0);
+}
+
+}  // namespace ccb
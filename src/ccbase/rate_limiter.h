@@ -0,0 +1,180 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CCBASE_RATE_LIMITER_H_
+#define CCBASE_RATE_LIMITER_H_
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <vector>
+#include "ccbase/clock.h"
+#include "ccbase/common.h"
+
+namespace ccb {
+
+// Limiters with the interface of TokenBucket, Gen() reads the clock and
+// the following Get/Check/Overdraft calls are judged at that time. Explicit
+// tv_now should be of the time base of clock_source.
+
+// GcraConfig is the limit of the generic cell rate algorithm, which is the
+// same limit as TokenBucket but keeps only the theoretical arrival time (TAT)
+// of the next token. The state of a limited entity is a single 64-bit TAT so
+// many of them, e.g. one per key, share one config. Times are in fixed point
+// of 2^-10 ns wrapping at 2^64, so the interval between tokens is not rounded
+// to a whole ns and a TAT stays valid while it is less than kMaxIdle behind
+// the current time. A new TAT of Now() has a full bucket.
+class GcraConfig {
+ public:
+  static constexpr unsigned kFracBits = 10;
+  // about 104 days
+  static constexpr uint64_t kMaxIdle = 1UL << 63;
+
+  GcraConfig(uint32_t tokens_per_sec, uint32_t bucket_size,
+             ClockSource clock_source = ClockSource::kMonotonic);
+
+  void Mod(uint32_t tokens_per_sec, uint32_t bucket_size);
+  // current time of TAT
+  uint64_t Now(const struct timeval* tv_now = nullptr) const;
+
+  bool Get(uint64_t* tat, uint64_t now, uint32_t need_tokens) const;
+  bool Check(uint64_t tat, uint64_t now, uint32_t need_tokens) const;
+  int Overdraft(uint64_t* tat, uint64_t now, uint32_t need_tokens) const;
+  uint32_t tokens(uint64_t tat, uint64_t now) const;
+
+ private:
+  // debt is capped to keep TATs far from wrapping
+  static constexpr uint64_t kMaxWait = 1UL << 62;
+
+  static uint64_t Wait(uint64_t tat, uint64_t now) {
+    int64_t wait = static_cast<int64_t>(tat - now);
+    return wait > 0 ? wait : 0;
+  }
+
+  uint64_t emission_;   // interval between tokens
+  uint64_t tolerance_;  // bucket_size * emission_
+  uint32_t max_need_;   // bucket_size
+  ClockSource clock_source_;
+};
+
+inline bool GcraConfig::Get(uint64_t* tat, uint64_t now,
+                            uint32_t need_tokens) const {
+  if (need_tokens > max_need_) {
+    return false;
+  }
+  uint64_t wait = Wait(*tat, now) + need_tokens * emission_;
+  if (wait > tolerance_) {
+    return false;
+  }
+  *tat = now + wait;
+  return true;
+}
+
+inline bool GcraConfig::Check(uint64_t tat, uint64_t now,
+                              uint32_t need_tokens) const {
+  return need_tokens <= max_need_ &&
+         Wait(tat, now) + need_tokens * emission_ <= tolerance_;
+}
+
+// GcraRateLimiter is a single GCRA limited entity with its own config.
+class GcraRateLimiter {
+ public:
+  GcraRateLimiter(uint32_t tokens_per_sec, uint32_t bucket_size,
+                  ClockSource clock_source = ClockSource::kMonotonic);
+
+  void Gen(const struct timeval* tv_now = nullptr);
+  bool Get(uint32_t need_tokens = 1) {
+    return config_.Get(&tat_, now_, need_tokens);
+  }
+  void Mod(uint32_t tokens_per_sec, uint32_t bucket_size) {
+    config_.Mod(tokens_per_sec, bucket_size);
+  }
+  uint32_t tokens() const {
+    return config_.tokens(tat_, now_);
+  }
+  bool Check(uint32_t need_tokens) const {
+    return config_.Check(tat_, now_, need_tokens);
+  }
+  int Overdraft(uint32_t need_tokens) {
+    return config_.Overdraft(&tat_, now_, need_tokens);
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(GcraRateLimiter);
+
+  GcraConfig config_;
+  uint64_t now_;  // time of the last Gen()
+  uint64_t tat_;
+};
+
+// SlidingWindowRateLimiter allows at most limit tokens in any window of
+// window_ms. The window is divided into slots of counters and a slot is
+// dropped only after all its tokens are older than the window, so the
+// limit is strict at the cost of up to one slot of extra delay.
+class SlidingWindowRateLimiter {
+ public:
+  SlidingWindowRateLimiter(uint32_t limit, uint32_t window_ms,
+                           uint32_t slots = 60,
+                           ClockSource clock_source = ClockSource::kMonotonic);
+
+  void Gen(const struct timeval* tv_now = nullptr);
+  bool Get(uint32_t need_tokens = 1);
+  uint32_t tokens() const;
+  bool Check(uint32_t need_tokens) const;
+  int Overdraft(uint32_t need_tokens);
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(SlidingWindowRateLimiter);
+
+  void Advance(uint64_t slot_index);
+
+  MonotonicClock clock_;
+  uint64_t limit_;
+  uint64_t slot_ns_;
+  uint64_t cur_slot_index_;
+  uint64_t total_;
+  // slots + 1 counters with the current one partially filled
+  std::vector<uint32_t> counts_;
+};
+
+inline bool SlidingWindowRateLimiter::Check(uint32_t need_tokens) const {
+  return total_ + need_tokens <= limit_;
+}
+
+inline bool SlidingWindowRateLimiter::Get(uint32_t need_tokens) {
+  if (total_ + need_tokens > limit_) {
+    return false;
+  }
+  counts_[cur_slot_index_ % counts_.size()] += need_tokens;
+  total_ += need_tokens;
+  return true;
+}
+
+}  // namespace ccb
+
+#endif  // CCBASE_RATE_LIMITER_H_
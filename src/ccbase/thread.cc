@@ -28,11 +28,76 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <sys/prctl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <set>
 #include <utility>
 #include "ccbase/thread.h"
 
 namespace ccb {
 
+namespace {
+
+constexpr char kSysCpuPath[] = "/sys/devices/system/cpu/";
+constexpr char kSysNodePath[] = "/sys/devices/system/node/";
+
+bool ReadSysFile(const std::string& path, std::string* content) {
+  std::ifstream ifs(path);
+  if (!ifs || !std::getline(ifs, *content)) {
+    return false;
+  }
+  return true;
+}
+
+// parse cpu list format used by sysfs, e.g. "0-3,8,10-11"
+std::vector<int> ParseCpuList(const std::string& str) {
+  std::vector<int> cpus;
+  const char* p = str.c_str();
+  while (*p) {
+    char* end;
+    long first = strtol(p, &end, 10);  // NOLINT
+    if (end == p) break;
+    long last = first;  // NOLINT
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1) break;
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {  // NOLINT
+      cpus.push_back(static_cast<int>(cpu));
+    }
+    if (*p == ',') {
+      p++;
+    } else if (*p) {
+      break;
+    }
+  }
+  return cpus;
+}
+
+std::vector<int> GetOnlineCpus() {
+  std::string str;
+  if (ReadSysFile(std::string(kSysCpuPath) + "online", &str)) {
+    std::vector<int> cpus = ParseCpuList(str);
+    if (!cpus.empty()) {
+      return cpus;
+    }
+  }
+  std::vector<int> cpus;
+  for (unsigned i = 0; i < std::thread::hardware_concurrency(); i++) {
+    cpus.push_back(static_cast<int>(i));
+  }
+  return cpus;
+}
+
+}  // namespace
+
 static void SetThreadName(const std::string& name) {
   if (name.size() > 0) {
     char buf[17];
@@ -71,4 +136,70 @@ void CreateDetachedThread(const std::string& name, ClosureFunc<void()> func) {
   }).detach();
 }
 
+bool SetThreadAffinity(const std::vector<int>& cpus) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return false;
+    }
+    CPU_SET(cpu, &cpu_set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                &cpu_set) == 0;
+}
+
+std::vector<int> GetPhysicalCoreCpus() {
+  std::vector<int> cpus;
+  std::set<std::pair<std::string, std::string>> cores;
+  for (int cpu : GetOnlineCpus()) {
+    std::string topo = std::string(kSysCpuPath) + "cpu" + std::to_string(cpu)
+                       + "/topology/";
+    std::string package_id, core_id;
+    if (!ReadSysFile(topo + "physical_package_id", &package_id) ||
+        !ReadSysFile(topo + "core_id", &core_id)) {
+      // topology unknown, treat each logical cpu as a core
+      cpus.push_back(cpu);
+      continue;
+    }
+    if (cores.emplace(package_id, core_id).second) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<std::vector<int>> GetNumaNodeCpus() {
+  std::vector<std::pair<int, std::vector<int>>> nodes;
+  DIR* dir = opendir(kSysNodePath);
+  if (dir) {
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != nullptr) {
+      char* end;
+      if (strncmp(ent->d_name, "node", 4) != 0) continue;
+      long node_id = strtol(ent->d_name + 4, &end, 10);  // NOLINT
+      if (end == ent->d_name + 4 || *end) continue;
+      std::string str;
+      if (!ReadSysFile(std::string(kSysNodePath) + ent->d_name + "/cpulist",
+                       &str)) {
+        continue;
+      }
+      std::vector<int> cpus = ParseCpuList(str);
+      if (!cpus.empty()) {
+        nodes.emplace_back(static_cast<int>(node_id), std::move(cpus));
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(nodes.begin(), nodes.end());
+  std::vector<std::vector<int>> result;
+  for (auto& node : nodes) {
+    result.push_back(std::move(node.second));
+  }
+  if (result.empty()) {
+    result.push_back(GetOnlineCpus());
+  }
+  return result;
+}
+
 }  // namespace ccb
@@ -32,6 +32,7 @@
 
 #include <thread>
 #include <string>
+#include <vector>
 #include "ccbase/common.h"
 #include "ccbase/closure.h"
 
@@ -42,6 +43,13 @@ std::thread CreateThread(const std::string& name, ClosureFunc<void()> func);
 void CreateDetachedThread(ClosureFunc<void()> func);
 void CreateDetachedThread(const std::string& name, ClosureFunc<void()> func);
 
+// bind the calling thread to the cpus, return false if failed
+bool SetThreadAffinity(const std::vector<int>& cpus);
+// one logical cpu for each online physical core
+std::vector<int> GetPhysicalCoreCpus();
+// online cpus grouped by numa node, one group if numa is not available
+std::vector<std::vector<int>> GetNumaNodeCpus();
+
 }  // namespace ccb
 
 #endif  // CCBASE_THREAD_H_
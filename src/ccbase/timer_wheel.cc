@@ -27,12 +27,12 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-#include <time.h>
 #include <mutex>
 #include <atomic>
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <stdexcept>
 #include "ccbase/timer_wheel.h"
 #include "ccbase/macro_list.h"
 
@@ -49,15 +49,34 @@ constexpr uint64_t kTimerVecRootSize = 1UL << kTimerVecRootBits;
 constexpr uint64_t kTimerVecMask = kTimerVecSize - 1;
 constexpr uint64_t kTimerVecRootMask = kTimerVecRootSize - 1;
 constexpr uint64_t kTimerMaxTimeout = 0xffffffffUL;
+constexpr uint64_t kBitmapWordBits = 64;
+constexpr uint64_t kBitmapWords = kTimerVecRootSize / kBitmapWordBits;
+constexpr size_t kTimerNodeSlabSize = 256;
+
+// Move the expiration to the tick within [expire, expire + slack] which has
+// the most trailing zero bits, so timers with slack fire in batches and
+// are cascaded less.
+inline uint64_t ApplySlack(uint64_t expire, uint64_t slack) {
+  if (slack == 0) {
+    return expire;
+  }
+  uint64_t limit = expire + slack;
+  int bit = 63 - __builtin_clzll(expire ^ limit);
+  return limit & ~((1UL << bit) - 1);
+}
 
 // timer node flags
 constexpr int kTimerFlagHasOwner = 0x1;
 constexpr int kTimerFlagPeriod = 0x2;
+constexpr int kTimerFlagOrphan = 0x4;
+constexpr int kTimerFlagPosted = 0x8;
 
 }  // namespace
 
 namespace ccb {
 
+constexpr tick_t TimerWheel::kNoTimer;
+
 struct ListNode {
   ListHead list;
 };
@@ -66,9 +85,140 @@ struct TimerWheelNode : ListNode {
   tick_t timeout;
   tick_t expire;
   ClosureFunc<void()> callback;
+  // inline callback which needs no closure, used if set
+  TimerWheel::TimerFunc func = nullptr;
+  void* arg = nullptr;
+  // MoveOn sequence of the thread which last collected it to fire
+  uint64_t fire_seq = 0;
+  // number of MoveOn running its callback by reference
+  uint32_t pins = 0;
+  // link in the inbox of posted timers
+  TimerWheelNode* next_posted = nullptr;
   uint8_t flags;
 };
 
+// Open addressing set of nodes deleted while running the callbacks, so a
+// fired timer can be checked in O(1). Only pointers are compared as the
+// nodes may have been freed.
+class DeadNodeSet {
+ public:
+  bool empty() const {
+    return size_ == 0;
+  }
+  void Insert(TimerWheelNode* node) {
+    if ((size_ + 1) * 2 > slots_.size()) {
+      Rehash(slots_.empty() ? kMinCapacity : slots_.size() * 2);
+    }
+    if (InsertSlot(node)) {
+      size_++;
+    }
+  }
+  bool Contains(TimerWheelNode* node) const {
+    if (size_ == 0) {
+      return false;
+    }
+    size_t mask = slots_.size() - 1;
+    for (size_t i = Hash(node) & mask; slots_[i]; i = (i + 1) & mask) {
+      if (slots_[i] == node) {
+        return true;
+      }
+    }
+    return false;
+  }
+  void Clear() {
+    if (size_ == 0) {
+      return;
+    }
+    // keep clearing cost proportional to this round, shrink after a burst
+    size_t capacity = kMinCapacity;
+    while (capacity < size_ * 2) capacity *= 2;
+    if (slots_.size() > capacity * 4) {
+      std::vector<TimerWheelNode*>(capacity, nullptr).swap(slots_);
+    } else {
+      std::fill(slots_.begin(), slots_.end(), nullptr);
+    }
+    size_ = 0;
+  }
+
+ private:
+  static constexpr size_t kMinCapacity = 64;
+
+  static size_t Hash(TimerWheelNode* node) {
+    return (reinterpret_cast<uintptr_t>(node) >> 4) * 0x9e3779b97f4a7c15UL
+           >> 32;
+  }
+  bool InsertSlot(TimerWheelNode* node) {
+    size_t mask = slots_.size() - 1;
+    size_t i = Hash(node) & mask;
+    for (; slots_[i]; i = (i + 1) & mask) {
+      if (slots_[i] == node) {
+        return false;
+      }
+    }
+    slots_[i] = node;
+    return true;
+  }
+  void Rehash(size_t capacity) {
+    std::vector<TimerWheelNode*> old(capacity, nullptr);
+    old.swap(slots_);
+    for (TimerWheelNode* node : old) {
+      if (node) InsertSlot(node);
+    }
+  }
+
+  std::vector<TimerWheelNode*> slots_;
+  size_t size_ = 0;
+};
+
+// expired timer collected by PollTimerWheel
+struct TimerTask {
+  TimerWheelNode* node;
+  ClosureFunc<void()> callback;
+  TimerWheel::TimerFunc func;
+  void* arg;
+  // the node is pinned and its callback is run by reference
+  bool pinned;
+};
+
+// Slab allocator of the nodes of owner-less timers. Free nodes are kept
+// constructed and linked by their list head, the pool is protected by the
+// wheel lock or only accessed by the owner thread of an unlocked wheel.
+class TimerNodePool {
+ public:
+  TimerNodePool() {
+    CCB_INIT_LIST_HEAD(&free_list_);
+  }
+  TimerWheelNode* Alloc() {
+    if (CCB_LIST_EMPTY(&free_list_)) {
+      Grow();
+    }
+    ListHead* curr = free_list_.next;
+    CCB_LIST_DEL_INIT(curr);
+    return static_cast<TimerWheelNode*>(CCB_LIST_ENTRY(curr, ListNode, list));
+  }
+  void Free(TimerWheelNode* node) {
+    // release the closure but keep the node constructed
+    node->callback = nullptr;
+    node->func = nullptr;
+    node->arg = nullptr;
+    CCB_LIST_ADD(&node->list, &free_list_);
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(TimerNodePool);
+
+  void Grow() {
+    slabs_.emplace_back(new TimerWheelNode[kTimerNodeSlabSize]);
+    TimerWheelNode* slab = slabs_.back().get();
+    for (size_t i = 0; i < kTimerNodeSlabSize; i++) {
+      CCB_LIST_ADD(&slab[i].list, &free_list_);
+    }
+  }
+
+  ListHead free_list_;
+  std::vector<std::unique_ptr<TimerWheelNode[]>> slabs_;
+};
+
 struct TimerVecRoot {
   int index;
   ListHead vec[kTimerVecRootSize];
@@ -88,6 +238,9 @@ struct TimerWheelVecs {
   TimerVec* const tvecs[kTimerWheelVecs] = {
     reinterpret_cast<TimerVec *>(&tv1), &tv2, &tv3, &tv4, &tv5
   };
+  // occupancy bitmaps of each vec, a set bit may be stale (slot is empty)
+  // but an occupied slot always has its bit set
+  uint64_t bitmaps[kTimerWheelVecs][kBitmapWords] = {};
 
   TimerWheelVecs() {
     for (size_t i = 0; i < kTimerVecSize; i++) {
@@ -109,19 +262,32 @@ struct TimerWheelVecs {
 
 class TimerWheelImpl : public std::enable_shared_from_this<TimerWheelImpl> {
  public:
-  TimerWheelImpl(size_t us_per_tick, bool enable_lock);
+  TimerWheelImpl(size_t us_per_tick, bool enable_lock,
+                 ClockSource clock_source);
   ~TimerWheelImpl();
 
   bool AddTimer(tick_t timeout,
                 ClosureFunc<void()> callback,
-                TimerOwner* owner = nullptr);
+                TimerWheel::TimerFunc func,
+                void* arg,
+                TimerOwner* owner,
+                tick_t slack);
   bool ResetTimer(const TimerOwner& owner,
-                  tick_t timeout);
+                  tick_t timeout,
+                  tick_t slack);
   bool AddPeriodTimer(tick_t timeout,
                       ClosureFunc<void()> callback,
-                      TimerOwner* owner = nullptr);
+                      TimerWheel::TimerFunc func,
+                      void* arg,
+                      TimerOwner* owner);
   bool ResetPeriodTimer(const TimerOwner& owner,
                         tick_t timeout);
+  bool PostTimer(tick_t timeout,
+                 ClosureFunc<void()> callback,
+                 uint8_t flags);
+  bool HasPostedTimers() const {
+    return inbox_.load(std::memory_order_relaxed) != nullptr;
+  }
 
   void MoveOn() {
     MoveOn(nullptr);
@@ -134,19 +300,64 @@ class TimerWheelImpl : public std::enable_shared_from_this<TimerWheelImpl> {
   tick_t tick_cur() const {
     return tick_cur_.load(std::memory_order_relaxed);
   }
+  size_t us_per_tick() const {
+    return us_per_tick_;
+  }
+  tick_t NextExpiryTicks() {
+    if (HasPostedTimers()) {
+      // not armed yet
+      return 0;
+    }
+    Locker lock(mutex_, enable_lock_);
+    return NextExpiryTicksInLock();
+  }
   // used by TimerOwner
   void DelTimerNode(TimerWheelNode* node);
+  void FreeOwnedNode(TimerWheelNode* node);
 
  private:
   bool AddTimerNode(TimerWheelNode* node);
+  bool AddPooledTimer(tick_t timeout,
+                      ClosureFunc<void()> callback,
+                      TimerWheel::TimerFunc func,
+                      void* arg,
+                      uint8_t flags,
+                      tick_t slack = 0);
+  bool AddOwnedTimer(tick_t timeout,
+                     ClosureFunc<void()> callback,
+                     TimerWheel::TimerFunc func,
+                     void* arg,
+                     TimerOwner* owner,
+                     uint8_t flags,
+                     tick_t slack = 0);
+  bool ResetOwnedTimer(TimerWheelNode* node, tick_t timeout, uint8_t flags,
+                       tick_t slack = 0);
   void AddTimerNodeInLock(TimerWheelNode* node);
   void DelTimerNodeInLock(TimerWheelNode* node);
-  void CascadeTimers(TimerVec* tv);
-  void PollTimerWheel(std::vector<std::pair<TimerWheelNode*,
-                                            ClosureFunc<void()>>>* out);
+  void CascadeTimers(size_t level);
+  tick_t NextExpiryTicksInLock();
+  void FastForwardInLock(tick_t tick);
+  void MarkSlot(size_t level, size_t slot) {
+    wheel_.bitmaps[level][slot / kBitmapWordBits] |=
+        1UL << (slot % kBitmapWordBits);
+  }
+  void UnmarkSlot(size_t level, size_t slot) {
+    wheel_.bitmaps[level][slot / kBitmapWordBits] &=
+        ~(1UL << (slot % kBitmapWordBits));
+  }
+  size_t FindNextSlot(size_t level, size_t start);
+  void DrainPostedTimersInLock();
+  void FreeNodeInLock(TimerWheelNode* node) {
+    if (node->flags & kTimerFlagPosted) {
+      delete node;
+    } else {
+      node_pool_.Free(node);
+    }
+  }
+  void PollTimerWheel(std::vector<TimerTask>* out);
+  void UnpinNodes(const std::vector<TimerTask>& tasks);
   void InitTick();
   tick_t GetTickNow() const;
-  tick_t ToTick(const struct timespec& ts) const;
 
  private:
   // conditional locker
@@ -165,23 +376,32 @@ class TimerWheelImpl : public std::enable_shared_from_this<TimerWheelImpl> {
 
  private:
   TimerWheelVecs wheel_;
+  TimerNodePool node_pool_;
+  // lock-free stack of timers posted by other threads
+  std::atomic<TimerWheelNode*> inbox_{nullptr};
   std::mutex mutex_;
   size_t us_per_tick_;
   bool enable_lock_;
   size_t timer_count_;
   std::atomic<tick_t> tick_cur_;
-  struct timespec ts_start_;
+  MonotonicClock clock_;
+  uint64_t ns_start_;
+  uint64_t ns_to_tick_mult_;
   static thread_local bool tls_tracking_dead_nodes_;
-  static thread_local std::vector<TimerWheelNode*> tls_dead_nodes_;
+  static thread_local uint64_t tls_fire_seq_;
+  static thread_local DeadNodeSet tls_dead_nodes_;
 };
 
 thread_local bool TimerWheelImpl::tls_tracking_dead_nodes_{false};
-thread_local std::vector<TimerWheelNode*> TimerWheelImpl::tls_dead_nodes_;
+thread_local uint64_t TimerWheelImpl::tls_fire_seq_{0};
+thread_local DeadNodeSet TimerWheelImpl::tls_dead_nodes_;
 
-TimerWheelImpl::TimerWheelImpl(size_t us_per_tick, bool enable_lock)
+TimerWheelImpl::TimerWheelImpl(size_t us_per_tick, bool enable_lock,
+                               ClockSource clock_source)
     : us_per_tick_(us_per_tick)
     , enable_lock_(enable_lock)
-    , timer_count_(0) {
+    , timer_count_(0)
+    , clock_(clock_source) {
   InitTick();
 }
 
@@ -196,79 +416,60 @@ TimerWheelImpl::~TimerWheelImpl() {
         DelTimerNodeInLock(node);
         // if owner alive timer-wheel should never freed
         assert(!(node->flags & kTimerFlagHasOwner));
-        delete node;
+        FreeNodeInLock(node);
       }
     }
   }
+  for (TimerWheelNode *node = inbox_.load(std::memory_order_acquire), *next;
+       node; node = next) {
+    next = node->next_posted;
+    delete node;
+  }
 }
 
 bool TimerWheelImpl::AddTimer(tick_t timeout,
                               ClosureFunc<void()> callback,
-                              TimerOwner* owner) {
-  if (timeout > kTimerMaxTimeout) {
+                              TimerWheel::TimerFunc func,
+                              void* arg,
+                              TimerOwner* owner,
+                              tick_t slack) {
+  if (timeout > kTimerMaxTimeout || slack > kTimerMaxTimeout - timeout) {
     return false;
   }
-  TimerWheelNode* node = nullptr;
-  if (owner) {
-    if (owner->has_timer()) {
-      node = owner->timer_.get();
-      DelTimerNode(node);
-    } else {
-      node = new TimerWheelNode;
-      owner->timer_.reset(node);
-    }
-    owner->timer_wheel_ = shared_from_this();
-  } else {
-    node = new TimerWheelNode;
+  if (!owner) {
+    return AddPooledTimer(timeout, std::move(callback), func, arg, 0, slack);
   }
-  node->timeout = timeout;
-  node->expire = tick_cur() + timeout;
-  node->callback = std::move(callback);
-  node->flags = (owner ? kTimerFlagHasOwner : 0);
-  return AddTimerNode(node);
+  return AddOwnedTimer(timeout, std::move(callback), func, arg, owner, 0,
+                       slack);
 }
 
 bool TimerWheelImpl::ResetTimer(const TimerOwner& owner,
-                                tick_t timeout) {
-  if (timeout > kTimerMaxTimeout) {
+                                tick_t timeout,
+                                tick_t slack) {
+  if (timeout > kTimerMaxTimeout || slack > kTimerMaxTimeout - timeout) {
     return false;
   }
   if (!owner.has_timer()) {
     return false;
   }
-  TimerWheelNode* node = owner.timer_.get();
-  DelTimerNode(node);
-  node->timeout = timeout;
-  node->expire = tick_cur() + timeout;
-  node->flags = kTimerFlagHasOwner;
-  return AddTimerNode(node);
+  return ResetOwnedTimer(owner.timer_.get(), timeout, 0, slack);
 }
 
 bool TimerWheelImpl::AddPeriodTimer(tick_t timeout,
                                     ClosureFunc<void()> callback,
+                                    TimerWheel::TimerFunc func,
+                                    void* arg,
                                     TimerOwner* owner) {
   if (timeout > kTimerMaxTimeout || timeout == 0) {
     // 0-tick period timer is not allowed
     return false;
   }
-  TimerWheelNode* node = nullptr;
-  if (owner) {
-    if (owner->has_timer()) {
-      node = owner->timer_.get();
-      DelTimerNode(node);
-    } else {
-      node = new TimerWheelNode;
-      owner->timer_.reset(node);
-    }
-    owner->timer_wheel_ = shared_from_this();
-  } else {
-    node = new TimerWheelNode;
+  if (!owner) {
+    return AddPooledTimer(timeout, std::move(callback), func, arg,
+                          kTimerFlagPeriod);
   }
-  node->timeout = timeout;
-  node->expire = tick_cur() + timeout;
-  node->callback = std::move(callback);
-  node->flags = kTimerFlagPeriod | (owner ? kTimerFlagHasOwner : 0);
-  return AddTimerNode(node);
+  return AddOwnedTimer(timeout, std::move(callback), func, arg, owner,
+                       kTimerFlagPeriod);
 }
 
 bool TimerWheelImpl::ResetPeriodTimer(const TimerOwner& owner,
@@ -280,16 +481,12 @@ bool TimerWheelImpl::ResetPeriodTimer(const TimerOwner& owner,
   if (!owner.has_timer()) {
     return false;
   }
-  TimerWheelNode* node = owner.timer_.get();
-  DelTimerNode(node);
-  node->timeout = timeout;
-  node->expire = tick_cur() + timeout;
-  node->flags = kTimerFlagPeriod | kTimerFlagHasOwner;
-  return AddTimerNode(node);
+  return ResetOwnedTimer(owner.timer_.get(), timeout, kTimerFlagPeriod);
 }
 
-void TimerWheelImpl::CascadeTimers(TimerVec* tv) {
+void TimerWheelImpl::CascadeTimers(size_t level) {
   /* cascade all the timers from tv up one level */
+  TimerVec* tv = wheel_.tvecs[level];
   ListHead *head;
   ListHead *curr;
   ListHead *next;
@@ -302,44 +499,81 @@ void TimerWheelImpl::CascadeTimers(TimerVec* tv) {
   while (curr != head) {
     TimerWheelNode* node = CCB_TIMER_WHEEL_NODE(curr);
     next = curr->next;
+    // relinked without detaching, keep the count balanced
+    timer_count_--;
     AddTimerNodeInLock(node);
     curr = next;
   }
   CCB_INIT_LIST_HEAD(head);
+  UnmarkSlot(level, tv->index);
   tv->index = (tv->index + 1) & kTimerVecMask;
 }
 
 void TimerWheelImpl::MoveOn(ClosureFunc<void(ClosureFunc<void()>)> sched_func) {
-  thread_local std::vector<std::pair<TimerWheelNode*,
-                                     ClosureFunc<void()>>> cb_vec;
+  thread_local std::vector<TimerTask> cb_vec;
+  // nodes to fire are stamped with the sequence, only deleting them needs
+  // tracking
+  tls_fire_seq_++;
   PollTimerWheel(&cb_vec);
   tls_tracking_dead_nodes_ = true;
   // run callback without lock
+  size_t pinned = 0;
   for (auto& cb : cb_vec) {
-    TimerWheelNode* node = cb.first;
-    ClosureFunc<void()>& callback = cb.second;
-    if (node && !tls_dead_nodes_.empty() &&
-        std::find(tls_dead_nodes_.begin(), tls_dead_nodes_.end(), node)
-               != tls_dead_nodes_.end()) {
+    TimerWheelNode* node = cb.node;
+    ClosureFunc<void()>& callback = (cb.pinned ? node->callback : cb.callback);
+    pinned += cb.pinned;
+    if (node && tls_dead_nodes_.Contains(node)) {
       // the timer has been deleted by previous callbacks
       continue;
     }
-    if (callback) {
+    if (cb.func) {
+      if (!sched_func) {
+        cb.func(cb.arg);
+      } else {
+        sched_func(BindClosure(cb.func, cb.arg));
+      }
+    } else if (callback) {
       if (!sched_func) {
         callback();
+      } else if (cb.pinned) {
+        // scheduled to run after the node may be unpinned
+        sched_func(callback);
       } else {
         sched_func(std::move(callback));
       }
     }
   }
   tls_tracking_dead_nodes_ = false;
-  tls_dead_nodes_.clear();
+  tls_dead_nodes_.Clear();
+  if (pinned > 0) {
+    UnpinNodes(cb_vec);
+  }
   cb_vec.clear();
 }
 
-void TimerWheelImpl::PollTimerWheel(
-    std::vector<std::pair<TimerWheelNode*, ClosureFunc<void()>>>* out) {
+void TimerWheelImpl::UnpinNodes(const std::vector<TimerTask>& tasks) {
+  thread_local std::vector<TimerWheelNode*> orphans;
+  {
+    Locker lock(mutex_, enable_lock_);
+    for (auto& task : tasks) {
+      if (task.pinned && --task.node->pins == 0 &&
+          (task.node->flags & kTimerFlagOrphan)) {
+        orphans.push_back(task.node);
+      }
+    }
+  }
+  // orphans are owned nodes which have been given up by the owners
+  for (TimerWheelNode* node : orphans) {
+    delete node;
+  }
+  orphans.clear();
+}
+
+void TimerWheelImpl::PollTimerWheel(std::vector<TimerTask>* out) {
   Locker lock(mutex_, enable_lock_);
+  if (HasPostedTimers()) {
+    DrainPostedTimersInLock();
+  }
 
   tick_t tick_to = GetTickNow();
   if (tick_to < tick_cur()) {
@@ -349,10 +583,20 @@ void TimerWheelImpl::PollTimerWheel(
   auto& tv1 = wheel_.tv1;
   auto& tvecs = wheel_.tvecs;
   while (tick_to >= tick_cur()) {
+    // skip empty ticks to the next one firing or cascading any timer
+    tick_t ticks = NextExpiryTicksInLock();
+    if (ticks > 0) {
+      if (ticks > tick_to - tick_cur()) {
+        FastForwardInLock(tick_to + 1);
+        break;
+      }
+      FastForwardInLock(tick_cur() + ticks);
+    }
+
     if (tv1.index == 0) {
       size_t n = 1;
       do {
-        CascadeTimers(tvecs[n]);
+        CascadeTimers(n);
       } while (tvecs[n]->index == 1 && ++n < kTimerWheelVecs);
     }
 
@@ -361,56 +605,274 @@ void TimerWheelImpl::PollTimerWheel(
       TimerWheelNode* node = CCB_TIMER_WHEEL_NODE(curr);
       DelTimerNodeInLock(node);
       if (node->flags & kTimerFlagPeriod) {  // period timer
-        // copy the callback closure
-        out->emplace_back(node, node->callback);
+        // pin the node rather than copying the callback closure
+        node->fire_seq = tls_fire_seq_;
+        node->pins++;
+        out->push_back({node, nullptr, node->func, node->arg, true});
         // reschedule
         node->expire = tick_cur() + node->timeout;
         AddTimerNodeInLock(node);
       } else {  // oneshot timer
         if (!(node->flags & kTimerFlagHasOwner)) {
           // no owner, move the callback closure
-          out->emplace_back(nullptr, std::move(node->callback));
-          delete node;
+          out->push_back({nullptr, std::move(node->callback),
+                          node->func, node->arg, false});
+          FreeNodeInLock(node);
         } else {
           // has owner, copy the callback closure
-          out->emplace_back(node, node->callback);
+          node->fire_seq = tls_fire_seq_;
+          out->push_back({node, node->callback, node->func, node->arg, false});
         }
       }
     }
+    UnmarkSlot(0, tv1.index);
     // next tick
     tick_cur_.store(tick_cur() + 1, std::memory_order_relaxed);
     tv1.index = (tv1.index + 1) & kTimerVecRootMask;
   }
 }
 
+size_t TimerWheelImpl::FindNextSlot(size_t level, size_t start) {
+  // find the first occupied slot from @start (cyclic) and return its offset
+  size_t size = (level == 0 ? kTimerVecRootSize : kTimerVecSize);
+  ListHead* vec = wheel_.tvecs[level]->vec;
+  for (size_t offset = 0; offset < size; ) {
+    size_t slot = (start + offset) & (size - 1);
+    uint64_t bits = wheel_.bitmaps[level][slot / kBitmapWordBits]
+                        >> (slot % kBitmapWordBits);
+    if (bits == 0) {
+      offset += kBitmapWordBits - slot % kBitmapWordBits;
+      continue;
+    }
+    offset += __builtin_ctzll(bits);
+    if (offset >= size) {
+      break;
+    }
+    slot = (start + offset) & (size - 1);
+    if (!CCB_LIST_EMPTY(vec + slot)) {
+      return offset;
+    }
+    // clear the stale bit
+    UnmarkSlot(level, slot);
+    offset++;
+  }
+  return size;
+}
+
+tick_t TimerWheelImpl::NextExpiryTicksInLock() {
+  if (timer_count_ == 0) {
+    return TimerWheel::kNoTimer;
+  }
+  tick_t next = TimerWheel::kNoTimer;
+  // timers in tv1 fire at the tick of their slot
+  size_t offset = FindNextSlot(0, wheel_.tv1.index);
+  if (offset < kTimerVecRootSize) {
+    next = offset;
+  }
+  // timers in upper vecs never fire before their slot is cascaded, which
+  // happens when all lower bits of the tick wrap to zero
+  tick_t tick = tick_cur();
+  for (size_t n = 1; n < kTimerWheelVecs; n++) {
+    uint64_t shift = kTimerVecRootBits + (n - 1) * kTimerVecBits;
+    tick_t cascade_ticks = (((tick + (1UL << shift) - 1) >> shift) << shift)
+                           - tick;
+    if (cascade_ticks >= next) {
+      // upper vecs can only cascade later
+      break;
+    }
+    offset = FindNextSlot(n, wheel_.tvecs[n]->index);
+    if (offset < kTimerVecSize) {
+      next = std::min(next, cascade_ticks + (offset << shift));
+    }
+  }
+  return next;
+}
+
+void TimerWheelImpl::FastForwardInLock(tick_t tick) {
+  // all skipped ticks must be empty, so just set the indexes as if every
+  // tick before has been processed: tv1 is indexed by the tick and each
+  // upper vec has cascaded once at every multiple of its slot span
+  tick_cur_.store(tick, std::memory_order_relaxed);
+  wheel_.tv1.index = static_cast<int>(tick & kTimerVecRootMask);
+  for (size_t n = 1; n < kTimerWheelVecs; n++) {
+    uint64_t shift = kTimerVecRootBits + (n - 1) * kTimerVecBits;
+    wheel_.tvecs[n]->index = static_cast<int>(
+        ((tick + (1UL << shift) - 1) >> shift) & kTimerVecMask);
+  }
+}
+
 inline bool TimerWheelImpl::AddTimerNode(TimerWheelNode* node) {
   Locker lock(mutex_, enable_lock_);
   AddTimerNodeInLock(node);
   return true;
 }
 
+bool TimerWheelImpl::AddPooledTimer(tick_t timeout,
+                                    ClosureFunc<void()> callback,
+                                    TimerWheel::TimerFunc func,
+                                    void* arg,
+                                    uint8_t flags,
+                                    tick_t slack) {
+  Locker lock(mutex_, enable_lock_);
+  TimerWheelNode* node = node_pool_.Alloc();
+  node->timeout = timeout;
+  node->expire = ApplySlack(tick_cur() + timeout, slack);
+  node->callback = std::move(callback);
+  node->func = func;
+  node->arg = arg;
+  node->flags = flags;
+  AddTimerNodeInLock(node);
+  return true;
+}
+
+bool TimerWheelImpl::AddOwnedTimer(tick_t timeout,
+                                   ClosureFunc<void()> callback,
+                                   TimerWheel::TimerFunc func,
+                                   void* arg,
+                                   TimerOwner* owner,
+                                   uint8_t flags,
+                                   tick_t slack) {
+  std::unique_ptr<TimerWheelNode> new_node;
+  if (!owner->has_timer()) {
+    new_node.reset(new TimerWheelNode);
+  }
+  owner->timer_wheel_ = shared_from_this();
+  // the replaced closure is released after unlock
+  ClosureFunc<void()> old_callback;
+  Locker lock(mutex_, enable_lock_);
+  TimerWheelNode* node = owner->timer_.get();
+  if (node) {
+    DelTimerNodeInLock(node);
+    if (node->pins > 0) {
+      // its callback may be running by reference, so leave the node to
+      // MoveOn and give the owner a new one
+      node->flags |= kTimerFlagOrphan;
+      owner->timer_.release();
+      new_node.reset(new TimerWheelNode);
+    } else {
+      old_callback = std::move(node->callback);
+    }
+  }
+  if (new_node) {
+    node = new_node.get();
+    owner->timer_ = std::move(new_node);
+  }
+  node->timeout = timeout;
+  node->expire = ApplySlack(tick_cur() + timeout, slack);
+  node->callback = std::move(callback);
+  node->func = func;
+  node->arg = arg;
+  node->flags = flags | kTimerFlagHasOwner;
+  AddTimerNodeInLock(node);
+  return true;
+}
+
+bool TimerWheelImpl::ResetOwnedTimer(TimerWheelNode* node,
+                                     tick_t timeout,
+                                     uint8_t flags,
+                                     tick_t slack) {
+  Locker lock(mutex_, enable_lock_);
+  DelTimerNodeInLock(node);
+  node->timeout = timeout;
+  node->expire = ApplySlack(tick_cur() + timeout, slack);
+  node->flags = flags | kTimerFlagHasOwner;
+  AddTimerNodeInLock(node);
+  return true;
+}
+
+bool TimerWheelImpl::PostTimer(tick_t timeout,
+                               ClosureFunc<void()> callback,
+                               uint8_t flags) {
+  if (timeout > kTimerMaxTimeout ||
+      (timeout == 0 && (flags & kTimerFlagPeriod))) {
+    return false;
+  }
+  if (enable_lock_) {
+    return AddPooledTimer(timeout, std::move(callback), nullptr, nullptr,
+                          flags);
+  }
+  // the pool is owned by the wheel thread, so allocate from heap
+  TimerWheelNode* node = new TimerWheelNode;
+  CCB_INIT_LIST_HEAD(&node->list);
+  node->timeout = timeout;
+  // the wheel may not move on for a long time, so count from the clock
+  node->expire = GetTickNow() + timeout;
+  node->callback = std::move(callback);
+  node->flags = flags | kTimerFlagPosted;
+  TimerWheelNode* head = inbox_.load(std::memory_order_relaxed);
+  do {
+    node->next_posted = head;
+  } while (!inbox_.compare_exchange_weak(head, node,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed));
+  return true;
+}
+
+void TimerWheelImpl::DrainPostedTimersInLock() {
+  TimerWheelNode* node = inbox_.exchange(nullptr, std::memory_order_acquire);
+  // reverse to add in the posting order
+  TimerWheelNode* prev = nullptr;
+  while (node) {
+    TimerWheelNode* next = node->next_posted;
+    node->next_posted = prev;
+    prev = node;
+    node = next;
+  }
+  for (node = prev; node; node = node->next_posted) {
+    // counted from the clock, it is beyond the wheel span if the wheel is
+    // behind, fire it at the end of the span which is a bit earlier
+    if (node->expire > tick_cur() &&
+        node->expire - tick_cur() > kTimerMaxTimeout) {
+      node->expire = tick_cur() + kTimerMaxTimeout;
+    }
+    AddTimerNodeInLock(node);
+  }
+}
+
+void TimerWheelImpl::FreeOwnedNode(TimerWheelNode* node) {
+  {
+    Locker lock(mutex_, enable_lock_);
+    DelTimerNodeInLock(node);
+    if (node->pins > 0) {
+      // freed by MoveOn after the running callback
+      node->flags |= kTimerFlagOrphan;
+      return;
+    }
+  }
+  delete node;
+}
+
 void TimerWheelImpl::AddTimerNodeInLock(TimerWheelNode* node) {
   // link the node
   tick_t tick_exp = node->expire;
   tick_t tick_now = tick_cur();
-  // exp < now may happen in multi-thread environment
-  tick_t idx = (tick_exp >= tick_now ? tick_exp - tick_now : 0);
+  // exp < now may happen in multi-thread environment or for posted timers,
+  // put it in the current slot to fire as soon as possible
+  if (tick_exp < tick_now) {
+    tick_exp = tick_now;
+  }
+  tick_t idx = tick_exp - tick_now;
   ListHead* vec;
   if (idx < kTimerVecRootSize) {
     int i = static_cast<int>(tick_exp & kTimerVecRootMask);
     vec = wheel_.tv1.vec + i;
+    MarkSlot(0, i);
   } else if (idx < (tick_t)1 << (kTimerVecRootBits + kTimerVecBits)) {
     int i = static_cast<int>((tick_exp >> kTimerVecRootBits) & kTimerVecMask);
     vec = wheel_.tv2.vec + i;
+    MarkSlot(1, i);
   } else if (idx < (tick_t)1 << (kTimerVecRootBits + 2 * kTimerVecBits)) {
     int i = static_cast<int>((tick_exp >> (kTimerVecRootBits + kTimerVecBits)) & kTimerVecMask);
     vec = wheel_.tv3.vec + i;
+    MarkSlot(2, i);
   } else if (idx < (tick_t)1 << (kTimerVecRootBits + 3 * kTimerVecBits)) {
     int i = static_cast<int>((tick_exp >> (kTimerVecRootBits + 2 * kTimerVecBits)) & kTimerVecMask);
     vec = wheel_.tv4.vec + i;
+    MarkSlot(3, i);
   } else if (idx < (tick_t)1 << (kTimerVecRootBits + 4 * kTimerVecBits)) {
     int i = static_cast<int>((tick_exp >> (kTimerVecRootBits + 3 * kTimerVecBits)) & kTimerVecMask);
     vec = wheel_.tv5.vec + i;
+    MarkSlot(4, i);
   } else {
     // exp - now > kTimerMaxTimeout
     assert(false);
@@ -421,14 +883,17 @@ void TimerWheelImpl::AddTimerNodeInLock(TimerWheelNode* node) {
 }
 
 inline void TimerWheelImpl::DelTimerNode(TimerWheelNode* node) {
-  if (tls_tracking_dead_nodes_) {
-    tls_dead_nodes_.push_back(node);
-  }
   Locker lock(mutex_, enable_lock_);
   DelTimerNodeInLock(node);
 }
 
 inline void TimerWheelImpl::DelTimerNodeInLock(TimerWheelNode* node) {
+  // it may be one of the timers being fired by this thread, a pinned
+  // period node may have been stamped again by another thread's MoveOn
+  if (tls_tracking_dead_nodes_ &&
+      (node->fire_seq == tls_fire_seq_ || node->pins > 0)) {
+    tls_dead_nodes_.Insert(node);
+  }
   // unlink the node
   if (!CCB_LIST_EMPTY(&(node->list))) {
     CCB_LIST_DEL_INIT(&(node->list));
@@ -437,34 +902,21 @@ inline void TimerWheelImpl::DelTimerNodeInLock(TimerWheelNode* node) {
 }
 
 void TimerWheelImpl::InitTick() {
-  if (clock_gettime(CLOCK_MONOTONIC, &ts_start_) < 0) {
-    throw std::system_error(errno, std::system_category(), "clock_gettime");
-  }
+  // reciprocal of ns per tick in 0.64 fixed point, so the conversion is a
+  // multiply, it could only be off by one at a tick boundary
+  uint64_t ns_per_tick = us_per_tick_ * 1000;
+  ns_to_tick_mult_ = ~0UL / ns_per_tick + 1;
+  ns_start_ = clock_.NowNs();
   tick_cur_.store(0, std::memory_order_relaxed);
 }
 
 tick_t TimerWheelImpl::GetTickNow() const {
-  struct timespec ts;
-  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
-    throw std::system_error(errno, std::system_category(), "clock_gettime");
+  uint64_t ns = clock_.NowNs();
+  if (ns < ns_start_) {
+    return 0;
   }
-  return ToTick(ts);
-}
-
-tick_t TimerWheelImpl::ToTick(const struct timespec& ts) const {
-  struct timespec dur;
-  if (ts.tv_nsec >= ts_start_.tv_nsec) {
-    dur.tv_nsec = ts.tv_nsec - ts_start_.tv_nsec;
-    dur.tv_sec = ts.tv_sec - ts_start_.tv_sec;
-  } else {
-    dur.tv_nsec = ts.tv_nsec + 1000000000 - ts_start_.tv_nsec;
-    dur.tv_sec = ts.tv_sec - 1 - ts_start_.tv_sec;
-  }
-  if (dur.tv_sec < 0) {
-    throw std::runtime_error("ToTick: invalid timespec value");
-  }
-  tick_t us = (static_cast<tick_t>(dur.tv_sec) * 1000000 + dur.tv_nsec / 1000);
-  return us / us_per_tick_;
+  return static_cast<tick_t>(
+      (static_cast<unsigned __int128>(ns - ns_start_) * ns_to_tick_mult_) >> 64);
 }
 
 
@@ -472,7 +924,9 @@ TimerOwner::TimerOwner() {
 }
 
 TimerOwner::~TimerOwner() {
-  Cancel();
+  if (has_timer()) {
+    timer_wheel_->FreeOwnedNode(timer_.release());
+  }
 }
 
 void TimerOwner::Cancel() {
@@ -482,8 +936,10 @@ void TimerOwner::Cancel() {
 }
 
 
-TimerWheel::TimerWheel(size_t us_per_tick, bool enable_lock_for_mt)
-  : pimpl_(std::make_shared<TimerWheelImpl>(us_per_tick, enable_lock_for_mt)) {
+TimerWheel::TimerWheel(size_t us_per_tick, bool enable_lock_for_mt,
+                       ClockSource clock_source)
+  : pimpl_(std::make_shared<TimerWheelImpl>(us_per_tick, enable_lock_for_mt,
+                                            clock_source)) {
 }
 
 TimerWheel::~TimerWheel() {
@@ -491,19 +947,38 @@ TimerWheel::~TimerWheel() {
 
 bool TimerWheel::AddTimer(tick_t timeout,
                           ClosureFunc<void()> callback,
-                          TimerOwner* owner) {
-  return pimpl_->AddTimer(timeout, std::move(callback), owner);
+                          TimerOwner* owner,
+                          tick_t slack) {
+  return pimpl_->AddTimer(timeout, std::move(callback), nullptr, nullptr,
+                          owner, slack);
+}
+
+bool TimerWheel::AddTimer(tick_t timeout,
+                          TimerFunc func,
+                          void* arg,
+                          TimerOwner* owner,
+                          tick_t slack) {
+  return pimpl_->AddTimer(timeout, nullptr, func, arg, owner, slack);
 }
 
 bool TimerWheel::ResetTimer(const TimerOwner& owner,
-                            tick_t timeout) {
-  return pimpl_->ResetTimer(owner, timeout);
+                            tick_t timeout,
+                            tick_t slack) {
+  return pimpl_->ResetTimer(owner, timeout, slack);
 }
 
 bool TimerWheel::AddPeriodTimer(tick_t timeout,
                                 ClosureFunc<void()> callback,
                                 TimerOwner* owner) {
-  return pimpl_->AddPeriodTimer(timeout, std::move(callback), owner);
+  return pimpl_->AddPeriodTimer(timeout, std::move(callback), nullptr, nullptr,
+                                owner);
+}
+
+bool TimerWheel::AddPeriodTimer(tick_t timeout,
+                                TimerFunc func,
+                                void* arg,
+                                TimerOwner* owner) {
+  return pimpl_->AddPeriodTimer(timeout, nullptr, func, arg, owner);
 }
 
 bool TimerWheel::ResetPeriodTimer(const TimerOwner& owner,
@@ -511,6 +986,19 @@ bool TimerWheel::ResetPeriodTimer(const TimerOwner& owner,
   return pimpl_->ResetPeriodTimer(owner, timeout);
 }
 
+bool TimerWheel::PostTimer(tick_t timeout, ClosureFunc<void()> callback) {
+  return pimpl_->PostTimer(timeout, std::move(callback), 0);
+}
+
+bool TimerWheel::PostPeriodTimer(tick_t timeout,
+                                 ClosureFunc<void()> callback) {
+  return pimpl_->PostTimer(timeout, std::move(callback), kTimerFlagPeriod);
+}
+
+bool TimerWheel::HasPostedTimers() const {
+  return pimpl_->HasPostedTimers();
+}
+
 void TimerWheel::MoveOn() {
   return pimpl_->MoveOn();
 }
@@ -527,5 +1015,61 @@ size_t TimerWheel::GetCurrentTick() const {
   return pimpl_->tick_cur();
 }
 
-}  // namespace ccb
+size_t TimerWheel::GetUsPerTick() const {
+  return pimpl_->us_per_tick();
+}
+
+tick_t TimerWheel::NextExpiryTicks() const {
+  return pimpl_->NextExpiryTicks();
+}
+
+ShardedTimerWheel::ShardedTimerWheel(size_t shards, size_t us_per_tick,
+                                     ClockSource clock_source) {
+  if (shards == 0) {
+    throw std::invalid_argument("ShardedTimerWheel: zero shards");
+  }
+  for (size_t i = 0; i < shards; i++) {
+    shards_.emplace_back(new TimerWheel(us_per_tick, true, clock_source));
+  }
+}
+
+ShardedTimerWheel::~ShardedTimerWheel() {
+}
+
+TimerWheel& ShardedTimerWheel::SelectShard(const TimerOwner* owner) {
+  size_t hash;
+  if (owner) {
+    hash = (reinterpret_cast<uintptr_t>(owner) >> 4) * 0x9e3779b97f4a7c15UL
+           >> 32;
+  } else {
+    static std::atomic<size_t> thread_seq{0};
+    thread_local size_t tls_thread_id =
+        thread_seq.fetch_add(1, std::memory_order_relaxed);
+    hash = tls_thread_id;
+  }
+  return *shards_[hash % shards_.size()];
+}
+
+void ShardedTimerWheel::MoveOn() {
+  for (auto& shard : shards_) {
+    shard->MoveOn();
+  }
+}
+
+size_t ShardedTimerWheel::GetTimerCount() const {
+  size_t count = 0;
+  for (auto& shard : shards_) {
+    count += shard->GetTimerCount();
+  }
+  return count;
+}
+
+tick_t ShardedTimerWheel::NextExpiryTicks() const {
+  tick_t next = TimerWheel::kNoTimer;
+  for (auto& shard : shards_) {
+    next = std::min(next, shard->NextExpiryTicks());
+  }
+  return next;
+}
 
+}  // namespace ccb
@@ -30,7 +30,10 @@
 #ifndef CCBASE_TIMER_WHEEL_H_
 #define CCBASE_TIMER_WHEEL_H_
 
+#include <assert.h>
 #include <memory>
+#include <vector>
+#include "ccbase/clock.h"
 #include "ccbase/closure.h"
 #include "ccbase/common.h"
 
@@ -44,26 +47,60 @@ using tick_t = uint64_t;
 
 class TimerWheel {
  public:
+  // returned by NextExpiryTicks() if there is no timer
+  static constexpr tick_t kNoTimer = static_cast<tick_t>(-1);
+  // inline callback invoked as func(arg)
+  using TimerFunc = void (*)(void*);
+
+  // kMonotonicCoarse suits ms ticks and kTsc suits us ticks best
   explicit TimerWheel(size_t us_per_tick = 1000,
-                      bool enable_lock_for_mt = true);
+                      bool enable_lock_for_mt = true,
+                      ClockSource clock_source = ClockSource::kMonotonic);
   ~TimerWheel();
 
+  // With slack the timer may fire up to slack ticks later than timeout,
+  // the wheel rounds the expiration to a coarse tick to fire timers in
+  // batches, e.g. slack = timeout / 20 for a +5% idle timeout.
   bool AddTimer(tick_t timeout,
                 ClosureFunc<void()> callback,
-                TimerOwner* owner = nullptr);
+                TimerOwner* owner = nullptr,
+                tick_t slack = 0);
   bool ResetTimer(const TimerOwner& owner,
-                  tick_t timeout);
+                  tick_t timeout,
+                  tick_t slack = 0);
   bool AddPeriodTimer(tick_t timeout,
                       ClosureFunc<void()> callback,
                       TimerOwner* owner = nullptr);
+  // The callback is stored inline in the timer node, together with the
+  // pooled node of owner-less timers no memory is allocated per timer.
+  bool AddTimer(tick_t timeout,
+                TimerFunc func,
+                void* arg,
+                TimerOwner* owner = nullptr,
+                tick_t slack = 0);
+  bool AddPeriodTimer(tick_t timeout,
+                      TimerFunc func,
+                      void* arg,
+                      TimerOwner* owner = nullptr);
   bool ResetPeriodTimer(const TimerOwner& owner,
                         tick_t timeout);
+  // Owner-less timers which can be added from any thread even if the wheel
+  // is unlocked. They are pushed into a lock-free inbox and armed by the
+  // next MoveOn(), the timeout counts from the time of posting.
+  bool PostTimer(tick_t timeout, ClosureFunc<void()> callback);
+  bool PostPeriodTimer(tick_t timeout, ClosureFunc<void()> callback);
+  bool HasPostedTimers() const;
 
   void MoveOn();
   void MoveOn(ClosureFunc<void(ClosureFunc<void()>)> sched_func);
 
   size_t GetTimerCount() const;
   tick_t GetCurrentTick() const;
+  size_t GetUsPerTick() const;
+  // A lower bound of ticks from GetCurrentTick() to the next expiration,
+  // no timer fires before it, or kNoTimer if there is no timer.
+  // It is cheap as only the wheel hierarchy is scanned.
+  tick_t NextExpiryTicks() const;
 
  private:
   CCB_NOT_COPYABLE_AND_MOVABLE(TimerWheel);
@@ -71,6 +108,83 @@ class TimerWheel {
   std::shared_ptr<TimerWheelImpl> pimpl_;
 };
 
+// ShardedTimerWheel spreads timers over several locked wheels to reduce
+// lock contention of multi-threaded users. A timer with owner always lives
+// in the shard selected by the owner address, and an owner-less timer goes
+// to the shard of the calling thread. Shards are driven either together by
+// MoveOn() or separately by MoveOn(shard), e.g. one shard per worker.
+class ShardedTimerWheel {
+ public:
+  explicit ShardedTimerWheel(size_t shards, size_t us_per_tick = 1000,
+                             ClockSource clock_source = ClockSource::kMonotonic);
+  ~ShardedTimerWheel();
+
+  bool AddTimer(tick_t timeout,
+                ClosureFunc<void()> callback,
+                TimerOwner* owner = nullptr,
+                tick_t slack = 0) {
+    return SelectShard(owner).AddTimer(timeout, std::move(callback), owner,
+                                       slack);
+  }
+  bool ResetTimer(const TimerOwner& owner,
+                  tick_t timeout,
+                  tick_t slack = 0) {
+    return SelectShard(&owner).ResetTimer(owner, timeout, slack);
+  }
+  bool AddPeriodTimer(tick_t timeout,
+                      ClosureFunc<void()> callback,
+                      TimerOwner* owner = nullptr) {
+    return SelectShard(owner).AddPeriodTimer(timeout, std::move(callback),
+                                             owner);
+  }
+  bool AddTimer(tick_t timeout,
+                TimerWheel::TimerFunc func,
+                void* arg,
+                TimerOwner* owner = nullptr,
+                tick_t slack = 0) {
+    return SelectShard(owner).AddTimer(timeout, func, arg, owner, slack);
+  }
+  bool AddPeriodTimer(tick_t timeout,
+                      TimerWheel::TimerFunc func,
+                      void* arg,
+                      TimerOwner* owner = nullptr) {
+    return SelectShard(owner).AddPeriodTimer(timeout, func, arg, owner);
+  }
+  bool ResetPeriodTimer(const TimerOwner& owner,
+                        tick_t timeout) {
+    return SelectShard(&owner).ResetPeriodTimer(owner, timeout);
+  }
+  bool PostTimer(tick_t timeout, ClosureFunc<void()> callback) {
+    return SelectShard(nullptr).PostTimer(timeout, std::move(callback));
+  }
+  bool PostPeriodTimer(tick_t timeout, ClosureFunc<void()> callback) {
+    return SelectShard(nullptr).PostPeriodTimer(timeout, std::move(callback));
+  }
+
+  void MoveOn();
+  void MoveOn(size_t shard) {
+    assert(shard < shards_.size());
+    shards_[shard]->MoveOn();
+  }
+  void MoveOn(size_t shard, ClosureFunc<void(ClosureFunc<void()>)> sched_func) {
+    assert(shard < shards_.size());
+    shards_[shard]->MoveOn(std::move(sched_func));
+  }
+
+  size_t GetShardCount() const {
+    return shards_.size();
+  }
+  size_t GetTimerCount() const;
+  tick_t NextExpiryTicks() const;
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(ShardedTimerWheel);
+
+  TimerWheel& SelectShard(const TimerOwner* owner);
+
+  std::vector<std::unique_ptr<TimerWheel>> shards_;
+};
+
 class TimerOwner {
  public:
   TimerOwner();
@@ -37,6 +37,8 @@
 #include <stdlib.h>
 #include <errno.h>
 
+#include <algorithm>
+
 #include "ccbase/token_bucket.h"
 
 #define TV2US(ptv) ((ptv)->tv_sec * 1000000 + (ptv)->tv_usec)
@@ -50,18 +52,39 @@ TokenBucket::TokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size)
   : TokenBucket(tokens_per_sec, bucket_size, bucket_size) {}
 
 TokenBucket::TokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size,
-                         uint32_t init_tokens, const struct timeval* tv_now) {
-  struct timeval tv;
+                         uint32_t init_tokens, const struct timeval* tv_now)
+  : gen_interval_us_(0), last_calc_delta_(0),
+    clock_source_(static_cast<uint32_t>(ClockSource::kMonotonic)),
+    use_clock_(false) {
+  tokens_per_sec_ = tokens_per_sec;
+  bucket_size_ = bucket_size ? bucket_size : 1;
+  token_count_ = init_tokens;
+  last_gen_time_ = ClockUs(tv_now);
+}
 
+TokenBucket::TokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size,
+                         uint32_t init_tokens, ClockSource clock_source,
+                         uint32_t gen_interval_us)
+  : gen_interval_us_(gen_interval_us), last_calc_delta_(0),
+    clock_source_(static_cast<uint32_t>(clock_source)),
+    use_clock_(true) {
   tokens_per_sec_ = tokens_per_sec;
   bucket_size_ = bucket_size ? bucket_size : 1;
   token_count_ = init_tokens;
-  if (!tv_now) {
-    tv_now = &tv;
-    gettimeofday(&tv, nullptr);
+  last_gen_time_ = ClockUs(nullptr);
+}
+
+uint64_t TokenBucket::ClockUs(const struct timeval* tv_now) const {
+  if (tv_now) {
+    return TV2US(tv_now);
+  }
+  if (use_clock_) {
+    return MonotonicClock::NowNs(
+        static_cast<ClockSource>(clock_source_)) / 1000;
   }
-  last_gen_time_ = TV2US(tv_now);
-  last_calc_delta_ = 0;
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return TV2US(&tv);
 }
 
 void TokenBucket::Mod(uint32_t tokens_per_sec, uint32_t bucket_size) {
@@ -70,29 +93,28 @@ void TokenBucket::Mod(uint32_t tokens_per_sec, uint32_t bucket_size) {
 }
 
 void TokenBucket::Gen(const struct timeval* tv_now) {
-  struct timeval tv;
   uint64_t us_now, us_past;
   uint64_t new_tokens, calc_delta;
   int64_t new_token_count;
 
-  if (tv_now == nullptr) {
-    tv_now = &tv;
-    gettimeofday(&tv, nullptr);
-  }
-  us_now = TV2US(tv_now);
+  us_now = ClockUs(tv_now);
   if (us_now < last_gen_time_) {
     last_gen_time_ = us_now;
     return;
   }
 
   us_past = us_now - last_gen_time_;
+  if (us_past < gen_interval_us_) {
+    // accumulated by the next refill
+    return;
+  }
   new_tokens = (((uint64_t)tokens_per_sec_ * us_past + last_calc_delta_)
                  / 1000000);
   calc_delta = (((uint64_t)tokens_per_sec_ * us_past + last_calc_delta_)
                  % 1000000);
 
   last_gen_time_ = us_now;
-  last_calc_delta_ = calc_delta;
+  last_calc_delta_ = (uint32_t)calc_delta;
   new_token_count = token_count_ + new_tokens;
   if (new_token_count < token_count_) {
     token_count_ = bucket_size_;
@@ -126,5 +148,23 @@ int TokenBucket::Overdraft(uint32_t need_tokens) {
   return (token_count_ < 0 ? -token_count_ : 0);
 }
 
+uint64_t TokenBucket::TimeUntil(uint32_t need_tokens,
+                                const struct timeval* tv_now) const {
+  if (token_count_ >= need_tokens) {
+    return 0;
+  }
+  if (need_tokens > bucket_size_ || tokens_per_sec_ == 0) {
+    return UINT64_MAX;
+  }
+  // the least us_past making Gen() produce the lacking tokens
+  uint64_t lack = need_tokens - token_count_;
+  uint64_t us_past = (lack * 1000000 - last_calc_delta_ + tokens_per_sec_ - 1)
+                     / tokens_per_sec_;
+  us_past = std::max<uint64_t>(us_past, gen_interval_us_);
+  uint64_t us_now = ClockUs(tv_now);
+  uint64_t us_ready = last_gen_time_ + us_past;
+  return (us_ready > us_now ? us_ready - us_now : 0);
+}
+
 }  // namespace ccb
 
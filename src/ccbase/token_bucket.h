@@ -33,6 +33,7 @@
 #include <sys/time.h>
 #include <stdint.h>
 #include "ccbase/common.h"
+#include "ccbase/clock.h"
 
 namespace ccb {
 
@@ -42,6 +43,13 @@ class TokenBucket {
   TokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size);
   TokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size,
               uint32_t init_tokens, const struct timeval* tv_now = nullptr);
+  // Gen() without tv_now reads clock_source instead of gettimeofday(), and
+  // explicit tv_now should be of the same time base then. The refill is
+  // skipped until gen_interval_us passed since the last one, which saves
+  // the division for frequent Gen() and loses no fraction of tokens.
+  TokenBucket(uint32_t tokens_per_sec, uint32_t bucket_size,
+              uint32_t init_tokens, ClockSource clock_source,
+              uint32_t gen_interval_us = 0);
   // copyable
   TokenBucket(const TokenBucket&) = default;
   TokenBucket& operator=(const TokenBucket&) = default;
@@ -52,18 +60,29 @@ class TokenBucket {
   uint32_t tokens() const;
   bool Check(uint32_t need_tokens);
   int Overdraft(uint32_t need_tokens);
+  // Microseconds from tv_now until need_tokens are available, 0 if they
+  // are available now or UINT64_MAX if never, e.g. more than bucket size.
+  uint64_t TimeUntil(uint32_t need_tokens,
+                     const struct timeval* tv_now = nullptr) const;
 
  private:
   // not movable
   TokenBucket(TokenBucket&&) = delete;
   TokenBucket& operator=(TokenBucket&&) = delete;
 
+  uint64_t ClockUs(const struct timeval* tv_now) const;
+
   uint32_t tokens_per_sec_;
   uint32_t bucket_size_;
+  uint32_t gen_interval_us_;
+  // the clock settings share a word with the fraction to keep 32 bytes
+  uint32_t last_calc_delta_ : 20;  // less than 1000000
+  uint32_t clock_source_ : 4;      // of ClockSource
+  uint32_t use_clock_ : 1;
   int64_t token_count_;
   uint64_t last_gen_time_;
-  uint64_t last_calc_delta_;
 };
+static_assert(sizeof(TokenBucket) == 32, "TokenBucket should be compact");
 
 inline uint32_t TokenBucket::tokens() const {
   return (uint32_t)(token_count_ <= 0 ? 0 : token_count_);
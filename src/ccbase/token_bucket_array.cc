@@ -0,0 +1,163 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include "ccbase/token_bucket_array.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CCB_HAVE_AVX2_KERNEL 1
+#endif
+
+#define TV2US(ptv) ((ptv)->tv_sec * 1000000 + (ptv)->tv_usec)
+
+namespace ccb {
+
+namespace {
+
+constexpr size_t kVectorWidth = 4;
+constexpr uint64_t kMicroTokens = 1000000;
+// rate * seconds stays below 2^53, all buckets are full long before it
+constexpr uint64_t kMaxGenSeconds = 1UL << 20;
+
+}  // namespace
+
+TokenBucketArray::TokenBucketArray(ClockSource clock_source,
+                                   bool enable_simd)
+    : clock_(clock_source),
+      simd_enabled_(false),
+      size_(0),
+      last_gen_time_(clock_.NowNs() / 1000) {
+#ifdef CCB_HAVE_AVX2_KERNEL
+  simd_enabled_ = enable_simd && __builtin_cpu_supports("avx2");
+#endif
+}
+
+size_t TokenBucketArray::Add(uint32_t tokens_per_sec, uint32_t bucket_size,
+                             uint32_t init_tokens) {
+  if (size_ == tokens_per_sec_.size()) {
+    size_t capacity = size_ + kVectorWidth;
+    tokens_per_sec_.resize(capacity, 0);
+    bucket_size_.resize(capacity, 0);
+    token_count_.resize(capacity, 0);
+    calc_delta_.resize(capacity, 0);
+  }
+  tokens_per_sec_[size_] = tokens_per_sec;
+  bucket_size_[size_] = bucket_size ? bucket_size : 1;
+  token_count_[size_] = init_tokens;
+  calc_delta_[size_] = 0;
+  return size_++;
+}
+
+void TokenBucketArray::Mod(size_t index, uint32_t tokens_per_sec,
+                           uint32_t bucket_size) {
+  tokens_per_sec_[index] = tokens_per_sec;
+  bucket_size_[index] = bucket_size ? bucket_size : 1;
+}
+
+int TokenBucketArray::Overdraft(size_t index, uint32_t need_tokens) {
+  token_count_[index] -= need_tokens;
+  return (token_count_[index] < 0 ? static_cast<int>(-token_count_[index]) : 0);
+}
+
+void TokenBucketArray::Gen(const struct timeval* tv_now) {
+  uint64_t us_now = (tv_now ? TV2US(tv_now) : clock_.NowNs() / 1000);
+  if (us_now < last_gen_time_) {
+    last_gen_time_ = us_now;
+    return;
+  }
+  uint64_t us_past = us_now - last_gen_time_;
+  last_gen_time_ = us_now;
+  // rate * us_past = rate * seconds * 10^6 + rate * us, the first part
+  // makes whole tokens and the second one is below 2^52
+  uint64_t seconds = std::min(us_past / kMicroTokens, kMaxGenSeconds);
+  uint64_t us = us_past % kMicroTokens;
+#ifdef CCB_HAVE_AVX2_KERNEL
+  if (simd_enabled_) {
+    GenSimd(seconds, us);
+    return;
+  }
+#endif
+  GenScalar(seconds, us);
+}
+
+void TokenBucketArray::GenScalar(uint64_t seconds, uint64_t us) {
+  for (size_t i = 0; i < size_; i++) {
+    uint64_t rate = static_cast<uint64_t>(tokens_per_sec_[i]);
+    uint64_t calc = rate * us + static_cast<uint64_t>(calc_delta_[i]);
+    int64_t new_tokens = rate * seconds + calc / kMicroTokens;
+    calc_delta_[i] = static_cast<double>(calc % kMicroTokens);
+    int64_t new_token_count = static_cast<int64_t>(token_count_[i]) +
+                              new_tokens;
+    token_count_[i] = static_cast<double>(std::min(
+        new_token_count, static_cast<int64_t>(bucket_size_[i])));
+  }
+}
+
+#ifdef CCB_HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+void TokenBucketArray::GenSimd(uint64_t seconds, uint64_t us) {
+  const __m256d v_seconds = _mm256_set1_pd(static_cast<double>(seconds));
+  const __m256d v_us = _mm256_set1_pd(static_cast<double>(us));
+  const __m256d v_micro = _mm256_set1_pd(static_cast<double>(kMicroTokens));
+  const __m256d v_inv_micro = _mm256_set1_pd(1.0 / kMicroTokens);
+  const __m256d v_zero = _mm256_setzero_pd();
+  const __m256d v_one = _mm256_set1_pd(1.0);
+  double* rate_ptr = tokens_per_sec_.data();
+  double* size_ptr = bucket_size_.data();
+  double* count_ptr = token_count_.data();
+  double* delta_ptr = calc_delta_.data();
+  for (size_t i = 0; i < size_; i += kVectorWidth) {
+    __m256d rate = _mm256_loadu_pd(rate_ptr + i);
+    __m256d delta = _mm256_loadu_pd(delta_ptr + i);
+    // all products are integers below 2^53 and so exact
+    __m256d calc = _mm256_add_pd(_mm256_mul_pd(rate, v_us), delta);
+    __m256d quot = _mm256_floor_pd(_mm256_mul_pd(calc, v_inv_micro));
+    __m256d rem = _mm256_sub_pd(calc, _mm256_mul_pd(quot, v_micro));
+    // the rounded quotient may be one off, fix it by the remainder
+    __m256d low = _mm256_cmp_pd(rem, v_zero, _CMP_LT_OQ);
+    quot = _mm256_sub_pd(quot, _mm256_and_pd(low, v_one));
+    rem = _mm256_add_pd(rem, _mm256_and_pd(low, v_micro));
+    __m256d high = _mm256_cmp_pd(rem, v_micro, _CMP_GE_OQ);
+    quot = _mm256_add_pd(quot, _mm256_and_pd(high, v_one));
+    rem = _mm256_sub_pd(rem, _mm256_and_pd(high, v_micro));
+    __m256d new_tokens = _mm256_add_pd(_mm256_mul_pd(rate, v_seconds), quot);
+    __m256d count = _mm256_add_pd(_mm256_loadu_pd(count_ptr + i),
+                                  new_tokens);
+    count = _mm256_min_pd(count, _mm256_loadu_pd(size_ptr + i));
+    _mm256_storeu_pd(count_ptr + i, count);
+    _mm256_storeu_pd(delta_ptr + i, rem);
+  }
+}
+#else
+void TokenBucketArray::GenSimd(uint64_t seconds, uint64_t us) {
+  GenScalar(seconds, us);
+}
+#endif
+
+}  // namespace ccb
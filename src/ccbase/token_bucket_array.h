@@ -0,0 +1,104 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CCBASE_TOKEN_BUCKET_ARRAY_H_
+#define CCBASE_TOKEN_BUCKET_ARRAY_H_
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <vector>
+#include "ccbase/clock.h"
+#include "ccbase/common.h"
+
+namespace ccb {
+
+// TokenBucketArray holds many token buckets, e.g. one per flow, in a
+// structure of arrays refilled together by one Gen() pass. The pass is an
+// AVX2 kernel if the CPU supports it or a scalar loop otherwise, and each
+// bucket gets exactly the tokens and carried fraction of TokenBucket::Gen.
+// Values are kept in doubles which are exact for integers below 2^53.
+class TokenBucketArray {
+ public:
+  explicit TokenBucketArray(ClockSource clock_source = ClockSource::kMonotonic,
+                            bool enable_simd = true);
+
+  // returns index of the new bucket
+  size_t Add(uint32_t tokens_per_sec, uint32_t bucket_size,
+             uint32_t init_tokens);
+  size_t size() const {
+    return size_;
+  }
+  // explicit tv_now should be of the time base of clock_source
+  void Gen(const struct timeval* tv_now = nullptr);
+  bool Get(size_t index, uint32_t need_tokens = 1);
+  void Mod(size_t index, uint32_t tokens_per_sec, uint32_t bucket_size);
+  uint32_t tokens(size_t index) const;
+  bool Check(size_t index, uint32_t need_tokens) const;
+  int Overdraft(size_t index, uint32_t need_tokens);
+  bool simd_enabled() const {
+    return simd_enabled_;
+  }
+
+ private:
+  CCB_NOT_COPYABLE_AND_MOVABLE(TokenBucketArray);
+
+  void GenScalar(uint64_t seconds, uint64_t us);
+  void GenSimd(uint64_t seconds, uint64_t us);
+
+  MonotonicClock clock_;
+  bool simd_enabled_;
+  size_t size_;
+  uint64_t last_gen_time_;
+  // padded to a multiple of the vector width with zero-rate buckets
+  std::vector<double> tokens_per_sec_;
+  std::vector<double> bucket_size_;
+  std::vector<double> token_count_;
+  std::vector<double> calc_delta_;
+};
+
+inline bool TokenBucketArray::Get(size_t index, uint32_t need_tokens) {
+  if (token_count_[index] < need_tokens) {
+    return false;
+  }
+  token_count_[index] -= need_tokens;
+  return true;
+}
+
+inline uint32_t TokenBucketArray::tokens(size_t index) const {
+  return (token_count_[index] <= 0 ?
+          0 : static_cast<uint32_t>(token_count_[index]));
+}
+
+inline bool TokenBucketArray::Check(size_t index, uint32_t need_tokens) const {
+  return token_count_[index] >= need_tokens;
+}
+
+}  // namespace ccb
+
+#endif  // CCBASE_TOKEN_BUCKET_ARRAY_H_
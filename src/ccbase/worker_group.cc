@@ -29,8 +29,11 @@
  */
 #include <stdio.h>
 #include <limits>
+#include <stdexcept>
 #include <utility>
 #include "ccbase/thread.h"
+#include "ccbase/epoll_poller.h"
+#include "ccbase/memory_reclamation.h"
 #include "ccbase/worker_group.h"
 
 namespace ccb {
@@ -39,44 +42,62 @@ namespace {
 
 constexpr size_t kMaxBatchProcessTasks = 16;
 constexpr size_t kPollerTimeoutMs = 1;
+// queues kept by each worker for client threads registered later
+constexpr size_t kReservedQueues = 2;
 
-class DefaultWorkerPoller : public WorkerGroup::Poller {
- public:
-  virtual ~DefaultWorkerPoller() {}
-  void Poll(size_t timeout_ms) override {
-    if (timeout_ms > 0) {
-      usleep(timeout_ms * 1000);
-    }
-  }
-  static std::shared_ptr<DefaultWorkerPoller> Instance() {
-    static std::shared_ptr<DefaultWorkerPoller> instance_{
-      new DefaultWorkerPoller
-    };
-    return instance_;
+}  // namespace
+
+constexpr size_t WorkerGroup::Poller::kInfiniteTimeout;
+
+WorkerGroup::Placement
+WorkerGroup::Placement::CpuList(const std::vector<int>& cpus) {
+  Placement placement;
+  for (int cpu : cpus) {
+    placement.cpu_sets_.push_back({cpu});
   }
-};
+  return placement;
+}
 
-}  // namespace
+WorkerGroup::Placement WorkerGroup::Placement::PhysicalCores() {
+  return CpuList(GetPhysicalCoreCpus());
+}
+
+WorkerGroup::Placement WorkerGroup::Placement::NumaNodes() {
+  Placement placement;
+  placement.cpu_sets_ = GetNumaNodeCpus();
+  return placement;
+}
 
 thread_local WorkerGroup::Worker* WorkerGroup::Worker::tls_self_ = nullptr;
 
 WorkerGroup::Worker::Worker(WorkerGroup* grp, size_t id,
-                            WorkerGroup::TaskQueue::InQueue* q,
+                            std::vector<int> cpus,
                             std::shared_ptr<WorkerGroup::Poller> poller)
     : TimerWheel(1000, false),
       group_(grp),
       id_(id),
-      inq_(q),
+      cpus_(std::move(cpus)),
+      inq_(nullptr),
       poller_(std::move(poller)),
-      stop_flag_(false) {
-  char name[16];
-  snprintf(name, sizeof(name), "w%lu-%lu", grp->id(), id);
-  thread_ = CreateThread(name, BindClosure(this, &Worker::WorkerMainEntry));
+      stop_flag_(false),
+      sleeping_(false) {
 }
 
 WorkerGroup::Worker::~Worker() {
-  stop_flag_.store(true, std::memory_order_release);
-  thread_.join();
+  if (thread_.joinable()) {
+    stop_flag_.store(true, std::memory_order_release);
+    poller_->Wakeup();
+    thread_.join();
+  }
+}
+
+void WorkerGroup::Worker::Start() {
+  char name[16];
+  snprintf(name, sizeof(name), "w%lu-%lu", group_->id(), id_);
+  thread_ = CreateThread(name, BindClosure(this, &Worker::WorkerMainEntry));
+  // consumer ids must follow worker ids so wait for the registration,
+  // and rethrow if the worker failed to start
+  started_.get_future().get();
 }
 
 bool WorkerGroup::Worker::PostTask(ClosureFunc<void()> func) {
@@ -85,14 +106,64 @@ bool WorkerGroup::Worker::PostTask(ClosureFunc<void()> func) {
 
 void WorkerGroup::Worker::WorkerMainEntry() {
   tls_self_ = this;
+  // bind cpus first then the queues are allocated on the local node
+  if (!cpus_.empty() && !SetThreadAffinity(cpus_)) {
+    started_.set_exception(std::make_exception_ptr(
+        std::invalid_argument("cannot bind worker to the cpus")));
+    return;
+  }
+  inq_ = group_->queue_->RegisterConsumer();
+  // queues are created when clients first post tasks, and they would be
+  // allocated on the nodes of the client threads if not reserved here
+  inq_->ReserveQueues(kReservedQueues);
+  started_.set_value();
   while (!stop_flag_.load(std::memory_order_acquire)) {
     TimerWheel::MoveOn();
     size_t n = BatchProcessTasks(kMaxBatchProcessTasks);
-    poller_->Poll(n < kMaxBatchProcessTasks ? kPollerTimeoutMs : 0);
+    if (n < kMaxBatchProcessTasks) {
+      PollOrSleep();
+    } else {
+      poller_->Poll(0);
+    }
   }
   BatchProcessTasks(std::numeric_limits<size_t>::max());
 }
 
+void WorkerGroup::Worker::PollOrSleep() {
+  // refill queues taken by new clients while idle
+  inq_->ReserveQueues(kReservedQueues);
+  if (!poller_->HasWakeup()) {
+    // an idle worker should not hold up QSBR reclamation either
+    QSBRDomain::Offline();
+    poller_->Poll(kPollerTimeoutMs);
+    QSBRDomain::Online();
+    return;
+  }
+  // one tick is 1ms, sleep one more tick to pass the expiring tick
+  tick_t ticks = NextExpiryTicks();
+  size_t timeout_ms = (ticks == kNoTimer ? Poller::kInfiniteTimeout
+                                         : ticks + 1);
+  sleeping_.store(true, std::memory_order_relaxed);
+  // StoreLoad barrier pairs with the one in Wakeup(): either the producer
+  // sees sleeping_ or we see the pushed task here
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (BatchProcessTasks(kMaxBatchProcessTasks) == 0 && !HasPostedTimers() &&
+      !stop_flag_.load(std::memory_order_acquire)) {
+    // a sleeping worker should not hold up QSBR reclamation
+    QSBRDomain::Offline();
+    poller_->Poll(timeout_ms);
+    QSBRDomain::Online();
+  }
+  sleeping_.store(false, std::memory_order_relaxed);
+}
+
+void WorkerGroup::Worker::Wakeup() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed)) {
+    poller_->Wakeup();
+  }
+}
+
 size_t WorkerGroup::Worker::BatchProcessTasks(size_t max) {
   size_t cnt;
   for (cnt = 0; cnt < max ; cnt++) {
@@ -101,24 +172,42 @@ size_t WorkerGroup::Worker::BatchProcessTasks(size_t max) {
       break;
     }
     func();
+    QSBRDomain::QuiescentState();
   }
   return cnt;
 }
 
 
 WorkerGroup::WorkerGroup(size_t worker_num, size_t queue_size)
-    : WorkerGroup(worker_num, queue_size, [](size_t) {
-        return DefaultWorkerPoller::Instance();
-      }) {
+    : WorkerGroup(worker_num, queue_size, Placement()) {
 }
 
 WorkerGroup::WorkerGroup(size_t worker_num, size_t queue_size,
                          PollerSupplier poller_supplier)
+    : WorkerGroup(worker_num, queue_size, std::move(poller_supplier),
+                  Placement()) {
+}
+
+WorkerGroup::WorkerGroup(size_t worker_num, size_t queue_size,
+                         const Placement& placement)
+    : WorkerGroup(worker_num, queue_size, [](size_t) {
+        return std::make_shared<EpollPoller>();
+      }, placement) {
+}
+
+WorkerGroup::WorkerGroup(size_t worker_num, size_t queue_size,
+                         PollerSupplier poller_supplier,
+                         const Placement& placement)
     : queue_(std::make_shared<TaskQueue>(queue_size)) {
   for (size_t id = 0; id < worker_num; id++) {
-    workers_.emplace_back(new Worker(this, id, queue_->RegisterConsumer(),
+    workers_.emplace_back(new Worker(this, id, placement.WorkerCpus(id),
                                      poller_supplier(id)));
   }
+  // start after all workers are created so that tasks can always find
+  // the target worker to wakeup
+  for (auto& worker : workers_) {
+    worker->Start();
+  }
 }
 
 WorkerGroup::~WorkerGroup() {
@@ -136,42 +225,62 @@ WorkerGroup::TaskQueue::OutQueue* WorkerGroup::GetOutQueue() {
 
 bool WorkerGroup::PostTask(ClosureFunc<void()> func) {
   TaskQueue::OutQueue* outq = GetOutQueue();
-  return outq->Push(std::move(func));
+  size_t worker_id;
+  if (!outq->Push(std::move(func), &worker_id)) {
+    return false;
+  }
+  WakeupWorker(worker_id);
+  return true;
 }
 
 bool WorkerGroup::PostTask(size_t worker_id, ClosureFunc<void()> func) {
   TaskQueue::OutQueue* outq = GetOutQueue();
-  return outq->Push(worker_id, std::move(func));
+  if (!outq->Push(worker_id, std::move(func))) {
+    return false;
+  }
+  WakeupWorker(worker_id);
+  return true;
 }
 
 bool WorkerGroup::PostTask(ClosureFunc<void()> func, size_t delay_ms) {
-  TaskQueue::OutQueue* outq = GetOutQueue();
-  return outq->Push([func, delay_ms] {
-    Worker::self()->AddTimer(delay_ms, std::move(func));
-  });
+  return PostTask(NextTimerWorker(), std::move(func), delay_ms);
 }
 
 bool WorkerGroup::PostTask(size_t worker_id, ClosureFunc<void()> func,
                            size_t delay_ms) {
-  TaskQueue::OutQueue* outq = GetOutQueue();
-  return outq->Push(worker_id, [func, delay_ms] {
-    Worker::self()->AddTimer(delay_ms, std::move(func));
-  });
+  // timers go to the inbox of the worker directly rather than the queue
+  if (worker_id >= workers_.size() ||
+      !workers_[worker_id]->PostTimer(delay_ms, std::move(func))) {
+    return false;
+  }
+  WakeupWorker(worker_id);
+  return true;
 }
 
 bool WorkerGroup::PostPeriodTask(ClosureFunc<void()> func, size_t period_ms) {
-  TaskQueue::OutQueue* outq = GetOutQueue();
-  return outq->Push([func, period_ms] {
-    Worker::self()->AddPeriodTimer(period_ms, std::move(func));
-  });
+  return PostPeriodTask(NextTimerWorker(), std::move(func), period_ms);
 }
 
 bool WorkerGroup::PostPeriodTask(size_t worker_id, ClosureFunc<void()> func,
                                  size_t period_ms) {
-  TaskQueue::OutQueue* outq = GetOutQueue();
-  return outq->Push(worker_id, [func, period_ms] {
-    Worker::self()->AddPeriodTimer(period_ms, std::move(func));
-  });
+  if (worker_id >= workers_.size() ||
+      !workers_[worker_id]->PostPeriodTimer(period_ms, std::move(func))) {
+    return false;
+  }
+  WakeupWorker(worker_id);
+  return true;
+}
+
+size_t WorkerGroup::NextTimerWorker() {
+  // spread the timers of each client thread over the workers
+  static thread_local size_t tls_next = 0;
+  return tls_next++ % workers_.size();
+}
+
+void WorkerGroup::WakeupWorker(size_t worker_id) {
+  if (worker_id < workers_.size()) {
+    workers_[worker_id]->Wakeup();
+  }
 }
 
 }  // namespace ccb
@@ -32,6 +32,7 @@
 
 #include <thread>
 #include <atomic>
+#include <future>
 #include <memory>
 #include <vector>
 #include "ccbase/common.h"
@@ -48,12 +49,46 @@ class WorkerGroup {
 
   class Poller {
    public:
+    static constexpr size_t kInfiniteTimeout = static_cast<size_t>(-1);
+
     virtual ~Poller() {}
-    // if timeout_ms is 0 the Poll call must be non-blocking
+    // if timeout_ms is 0 the Poll call must be non-blocking, kInfiniteTimeout
+    // is only used when HasWakeup() returns true
     virtual void Poll(size_t timeout_ms) = 0;
+    // if true the worker may block in Poll until Wakeup() is called
+    virtual bool HasWakeup() const {
+      return false;
+    }
+    // interrupt blocking Poll call, must be thread-safe
+    virtual void Wakeup() {}
   };
   using PollerSupplier = ClosureFunc<std::shared_ptr<Poller>(size_t worker_id)>;
 
+  // Placement decides which cpus each worker thread is bound to. Affinity is
+  // set before the worker registers its task queue and enters the main loop,
+  // so per-worker memory is first touched (allocated) on its home numa node.
+  // WorkerGroup constructor throws std::invalid_argument if binding fails.
+  class Placement {
+   public:
+    // no binding
+    Placement() = default;
+    // bind worker N to cpus[N % cpus.size()]
+    static Placement CpuList(const std::vector<int>& cpus);
+    // bind each worker to a distinct physical core (round-robin)
+    static Placement PhysicalCores();
+    // bind each worker to all cpus of a numa node (round-robin)
+    static Placement NumaNodes();
+
+    // cpus that the worker should be bound to, empty if no binding
+    std::vector<int> WorkerCpus(size_t worker_id) const {
+      return cpu_sets_.empty() ? std::vector<int>()
+                               : cpu_sets_[worker_id % cpu_sets_.size()];
+    }
+
+   private:
+    std::vector<std::vector<int>> cpu_sets_;
+  };
+
   class Worker : public TimerWheel {
    public:
     ~Worker();
@@ -78,16 +113,22 @@ class WorkerGroup {
    private:
     CCB_NOT_COPYABLE_AND_MOVABLE(Worker);
 
-    Worker(WorkerGroup* grp, size_t id, TaskQueue::InQueue* q,
+    Worker(WorkerGroup* grp, size_t id, std::vector<int> cpus,
            std::shared_ptr<Poller> poller);
+    void Start();
     void WorkerMainEntry();
+    void PollOrSleep();
     size_t BatchProcessTasks(size_t max);
+    void Wakeup();
 
     WorkerGroup* group_;
     size_t id_;
+    std::vector<int> cpus_;
     TaskQueue::InQueue* inq_;
     std::shared_ptr<Poller> poller_;
     std::atomic_bool stop_flag_;
+    std::atomic_bool sleeping_;
+    std::promise<void> started_;
     std::thread thread_;
     static thread_local Worker* tls_self_;
     friend class WorkerGroup;
@@ -97,6 +138,10 @@ class WorkerGroup {
   WorkerGroup(size_t worker_num, size_t queue_size);
   WorkerGroup(size_t worker_num, size_t queue_size,
               PollerSupplier poller_supplier);
+  WorkerGroup(size_t worker_num, size_t queue_size,
+              const Placement& placement);
+  WorkerGroup(size_t worker_num, size_t queue_size,
+              PollerSupplier poller_supplier, const Placement& placement);
   ~WorkerGroup();
   size_t id() const {
     return tls_client_ctx_.instance_id();
@@ -125,6 +170,8 @@ class WorkerGroup {
   CCB_NOT_COPYABLE_AND_MOVABLE(WorkerGroup);
 
   TaskQueue::OutQueue* GetOutQueue();
+  void WakeupWorker(size_t worker_id);
+  size_t NextTimerWorker();
 
   struct ClientContext {
     std::shared_ptr<TaskQueue> queue_holder;
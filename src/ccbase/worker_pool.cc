@@ -31,6 +31,7 @@
 #include <utility>
 #include <mutex>
 #include <algorithm>
+#include "ccbase/memory_reclamation.h"
 #include "ccbase/thread.h"
 #include "ccbase/worker_pool.h"
 
@@ -40,6 +41,9 @@ namespace {
 
 // wait 10 seconds before shrinking workers
 constexpr size_t kShrinkWorkersWaitMs = 10000;
+// max expired timer tasks taken by a worker at a time, it bounds the tasks
+// held up behind a slow one
+constexpr size_t kMaxTimerTaskBatch = 32;
 
 size_t HighWatermark(size_t total_workers) {
   // 3/4 total-workers
@@ -93,6 +97,7 @@ void WorkerPool::Worker::WorkerMainEntry() {
   while (pool_->WorkerPollTask(this, &task_func)) {
     pool_->WorkerBeginProcess(this);
     task_func();
+    QSBRDomain::QuiescentState();
     pool_->WorkerEndProcess(this);
   }
   ClosureFunc<void()> on_exit{std::move(on_exit_)};
@@ -120,6 +125,7 @@ WorkerPool::WorkerPool(size_t min_workers,
       next_worker_id_(0),
       last_above_low_watermark_ts_(0),
       timer_wheel_(1000, true),
+      pending_timer_tasks_(0),
       sched_timer_task_(BindClosure(this, &WorkerPool::SchedTimerTaskInLock)),
       task_queue_(std::make_shared<TaskQueue>(queue_size)),
       shared_inq_(task_queue_->RegisterConsumer()),
@@ -140,32 +146,75 @@ WorkerPool::~WorkerPool() {
 }
 
 bool WorkerPool::WorkerPollTask(Worker* worker, ClosureFunc<void()>* task) {
+  if (!worker->timer_batch_.empty() && ShouldReturnTimerBatch(worker)) {
+    ReturnTimerBatch(worker);
+  }
+  if (!worker->timer_batch_.empty()) {
+    // run the rest of the batch without lock
+    *task = std::move(worker->timer_batch_.back());
+    worker->timer_batch_.pop_back();
+    return true;
+  }
+  // waiting for the lock or tasks should not hold up QSBR reclamation
+  QSBRDomain::Offline();
   std::lock_guard<std::mutex> lock(polling_mutex_);
   while (!worker->stop_flag_.load(std::memory_order_acquire)) {
-    if (PollTimerTaskInLock(task)) {
-      return true;
-    }
-    if (shared_inq_->Pop(task)) {
+    if (PollTimerTaskInLock(worker, task) || shared_inq_->Pop(task)) {
+      QSBRDomain::Online();
       return true;
     }
     usleep(1000);
   }
+  QSBRDomain::Online();
   return shared_inq_->Pop(task);
 }
 
-bool WorkerPool::PollTimerTaskInLock(ClosureFunc<void()>* task) {
+bool WorkerPool::PollTimerTaskInLock(Worker* worker,
+                                     ClosureFunc<void()>* task) {
   timer_wheel_.MoveOn(sched_timer_task_);
   if (timer_task_queue_.empty()) {
     return false;
-  } else {
-    *task = std::move(timer_task_queue_.front());
-    timer_task_queue_.pop();
+  }
+  // take an even share of the expired tasks in one step, so a burst of
+  // expirations is spread over the workers rather than popped one by one
+  size_t workers = std::max<size_t>(total_workers_.load(
+      std::memory_order_relaxed), 1);
+  size_t share = (timer_task_queue_.size() + workers - 1) / workers;
+  share = std::min(share, kMaxTimerTaskBatch);
+  *task = std::move(timer_task_queue_.front());
+  auto end = timer_task_queue_.begin() + share;
+  auto& batch = worker->timer_batch_;
+  for (auto it = end - 1; it != timer_task_queue_.begin(); --it) {
+    batch.emplace_back(std::move(*it));
+  }
+  timer_task_queue_.erase(timer_task_queue_.begin(), end);
+  pending_timer_tasks_.store(timer_task_queue_.size(),
+                             std::memory_order_relaxed);
+  return true;
+}
+
+bool WorkerPool::ShouldReturnTimerBatch(Worker* worker) {
+  if (worker->stop_flag_.load(std::memory_order_acquire)) {
     return true;
   }
+  // other workers are idle and have no timer task left to take
+  size_t busy = busy_workers_.load(std::memory_order_relaxed);
+  return busy + 1 < total_workers_.load(std::memory_order_relaxed) &&
+         pending_timer_tasks_.load(std::memory_order_relaxed) == 0;
+}
+
+void WorkerPool::ReturnTimerBatch(Worker* worker) {
+  // hand the unstarted tasks over to the shared queue, where idle workers
+  // wait for them, and keep the rest if it is full
+  auto& batch = worker->timer_batch_;
+  TaskQueue::OutQueue* outq = GetOutQueue();
+  while (!batch.empty() && outq->Push(std::move(batch.back()))) {
+    batch.pop_back();
+  }
 }
 
 void WorkerPool::SchedTimerTaskInLock(ClosureFunc<void()> task) {
-  timer_task_queue_.push(std::move(task));
+  timer_task_queue_.emplace_back(std::move(task));
 }
 
 void WorkerPool::WorkerBeginProcess(Worker* worker) {
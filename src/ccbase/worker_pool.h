@@ -34,7 +34,8 @@
 #include <atomic>
 #include <memory>
 #include <map>
-#include <queue>
+#include <deque>
+#include <vector>
 #include "ccbase/common.h"
 #include "ccbase/closure.h"
 #include "ccbase/timer_wheel.h"
@@ -82,6 +83,8 @@ class WorkerPool {
     size_t id_;
     std::shared_ptr<Context> context_;
     std::atomic_bool stop_flag_;
+    // expired timer tasks taken as a batch, in reversed order
+    std::vector<ClosureFunc<void()>> timer_batch_;
     ClosureFunc<void()> on_exit_;
     std::thread thread_;
     static thread_local Worker* tls_self_;
@@ -118,7 +121,9 @@ class WorkerPool {
   using TaskQueue = DispatchQueue<ClosureFunc<void()>>;
 
   bool WorkerPollTask(Worker* worker, ClosureFunc<void()>* task);
-  bool PollTimerTaskInLock(ClosureFunc<void()>* task);
+  bool PollTimerTaskInLock(Worker* worker, ClosureFunc<void()>* task);
+  bool ShouldReturnTimerBatch(Worker* worker);
+  void ReturnTimerBatch(Worker* worker);
   void SchedTimerTaskInLock(ClosureFunc<void()> task);
   void WorkerBeginProcess(Worker* worker);
   void WorkerEndProcess(Worker* worker);
@@ -151,7 +156,9 @@ class WorkerPool {
   std::atomic<size_t> next_worker_id_;
   std::atomic<tick_t> last_above_low_watermark_ts_;
   TimerWheel timer_wheel_;
-  std::queue<ClosureFunc<void()>> timer_task_queue_;
+  std::deque<ClosureFunc<void()>> timer_task_queue_;
+  // size of timer_task_queue_ after the last poll, read without lock
+  std::atomic<size_t> pending_timer_tasks_;
   ClosureFunc<void(ClosureFunc<void()>)> sched_timer_task_;
   std::shared_ptr<TaskQueue> task_queue_;
   TaskQueue::InQueue* shared_inq_;
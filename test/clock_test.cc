@@ -0,0 +1,78 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include "gtestx/gtestx.h"
+#include "ccbase/clock.h"
+
+TEST(MonotonicClockTest, Sources) {
+  for (auto source : {ccb::ClockSource::kMonotonic,
+                      ccb::ClockSource::kMonotonicCoarse,
+                      ccb::ClockSource::kTsc}) {
+    ccb::MonotonicClock clock(source);
+    if (source == ccb::ClockSource::kTsc &&
+        !ccb::MonotonicClock::IsTscReliable()) {
+      ASSERT_EQ(ccb::ClockSource::kMonotonic, clock.source());
+    }
+    uint64_t begin = clock.NowNs();
+    usleep(20000);
+    uint64_t elapsed = clock.NowNs() - begin;
+    // coarse clock has jiffy precision
+    ASSERT_LT(15000000UL, elapsed);
+    ASSERT_GT(200000000UL, elapsed);
+  }
+}
+
+TEST(MonotonicClockTest, TscMatchesMonotonic) {
+  ccb::MonotonicClock mono;
+  ccb::MonotonicClock tsc(ccb::ClockSource::kTsc);
+  uint64_t mono_begin = mono.NowNs();
+  uint64_t tsc_begin = tsc.NowNs();
+  usleep(100000);
+  int64_t mono_elapsed = mono.NowNs() - mono_begin;
+  int64_t tsc_elapsed = tsc.NowNs() - tsc_begin;
+  // calibration error should be far below 1%
+  ASSERT_GT(mono_elapsed / 100, std::abs(tsc_elapsed - mono_elapsed));
+}
+
+PERF_TEST(MonotonicClockPerf, Monotonic) {
+  static ccb::MonotonicClock clock(ccb::ClockSource::kMonotonic);
+  clock.NowNs();
+}
+
+PERF_TEST(MonotonicClockPerf, MonotonicCoarse) {
+  static ccb::MonotonicClock clock(ccb::ClockSource::kMonotonicCoarse);
+  clock.NowNs();
+}
+
+PERF_TEST(MonotonicClockPerf, Tsc) {
+  static ccb::MonotonicClock clock(ccb::ClockSource::kTsc);
+  clock.NowNs();
+}
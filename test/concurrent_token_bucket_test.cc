@@ -0,0 +1,386 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "gtestx/gtestx.h"
+#include "ccbase/concurrent_token_bucket.h"
+
+TEST(AtomicTokenBucketTest, SameAsTokenBucket) {
+  // start in the future so that only Gen() refills
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  tv.tv_sec += 3600;
+  ccb::TokenBucket tb(7777, 1000, 0, &tv);
+  ccb::AtomicTokenBucket atb(7777, 1000, 0, &tv);
+  srand(1);
+  for (int i = 0; i < 10000; i++) {
+    tv.tv_usec += rand() % 1000;
+    if (tv.tv_usec >= 1000000) {
+      tv.tv_sec++;
+      tv.tv_usec -= 1000000;
+    }
+    tb.Gen(&tv);
+    atb.Gen(&tv);
+    ASSERT_EQ(tb.tokens(), atb.tokens());
+    uint32_t need = rand() % 10;
+    if (i % 7 == 0) {
+      ASSERT_EQ(tb.Overdraft(need), atb.Overdraft(need));
+    } else {
+      ASSERT_EQ(tb.Check(need), atb.Check(need));
+      ASSERT_EQ(tb.Get(need), atb.Get(need));
+    }
+  }
+}
+
+TEST(AtomicTokenBucketTest, TimeGoesBack) {
+  // start in the future so that only Gen() refills
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  tv.tv_sec += 3600;
+  tv.tv_usec = 0;
+  ccb::TokenBucket tb(10, 10, 0, &tv);
+  ccb::AtomicTokenBucket atb(10, 10, 0, &tv);
+  tv.tv_sec -= 10;
+  tb.Gen(&tv);
+  atb.Gen(&tv);
+  ASSERT_EQ(0U, atb.tokens());
+  // refilled from the new time on
+  tv.tv_usec = 500000;
+  tb.Gen(&tv);
+  atb.Gen(&tv);
+  ASSERT_EQ(5U, atb.tokens());
+  ASSERT_EQ(tb.tokens(), atb.tokens());
+}
+
+TEST(AtomicTokenBucketTest, Get) {
+  const unsigned int n = 10000;
+  ccb::AtomicTokenBucket atb(n, n);
+  ASSERT_TRUE(atb.Check(n));
+  ASSERT_TRUE(atb.Get(n));
+  ASSERT_FALSE(atb.Get(n / 10));
+  usleep(200000);
+  // refilled lazily
+  ASSERT_TRUE(atb.Get(n / 10));
+}
+
+TEST(AtomicTokenBucketTest, ClockSources) {
+  for (auto source : {ccb::ClockSource::kMonotonic,
+                      ccb::ClockSource::kMonotonicCoarse,
+                      ccb::ClockSource::kTsc}) {
+    ccb::AtomicTokenBucket atb(1000, 100, 0, source);
+    usleep(50000);
+    atb.Gen();
+    // coarse clock has jiffy precision
+    ASSERT_LE(40U, atb.tokens());
+    ASSERT_GE(100U, atb.tokens());
+  }
+}
+
+TEST(AtomicTokenBucketTest, Contention) {
+  constexpr uint32_t kRate = 100000;
+  constexpr uint32_t kBucketSize = kRate / 10;
+  constexpr size_t kThreads = 8;
+  auto start = std::chrono::steady_clock::now();
+  ccb::AtomicTokenBucket atb(kRate, kBucketSize);
+  std::atomic<size_t> got{0};
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < kThreads; t++) {
+    workers.emplace_back([&] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        if (atb.Get(1)) got.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  stop = true;
+  for (auto& w : workers) {
+    w.join();
+  }
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  // no token is granted twice or lost by a failed CAS
+  ASSERT_GE(kBucketSize + kRate * us / 1000000 + 1, got.load());
+  ASSERT_LE(kBucketSize + kRate / 10, got.load());
+}
+
+PERF_TEST(AtomicTokenBucketPerf, Get) {
+  static ccb::AtomicTokenBucket atb(1000000000, 1000000000);
+  atb.Get(1);
+}
+
+// Get by the test thread while other threads take the same bucket, the
+// baseline is a TokenBucket wrapped by a mutex
+template <bool kAtomic, size_t kThreads>
+struct ContentionParam {
+  static constexpr bool atomic = kAtomic;
+  // the test thread included
+  static constexpr size_t threads = kThreads;
+};
+
+template <class Param>
+class TokenBucketContention : public testing::Test {
+ protected:
+  void SetUp() {
+    for (size_t t = 1; t < Param::threads; t++) {
+      threads_.emplace_back([this] {
+        while (!stop_.load(std::memory_order_relaxed)) {
+          Get();
+        }
+      });
+    }
+  }
+  void TearDown() {
+    stop_ = true;
+    for (auto& t : threads_) {
+      t.join();
+    }
+  }
+  void Get() {
+    if (Param::atomic) {
+      atb_.Get(1);
+    } else {
+      std::lock_guard<std::mutex> lock(tb_mutex_);
+      if (!tb_.Get(1)) tb_.Gen();
+    }
+  }
+
+  ccb::AtomicTokenBucket atb_{1000000000, 1000000000};
+  ccb::TokenBucket tb_{1000000000, 1000000000};
+  std::mutex tb_mutex_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> stop_{false};
+};
+
+template <class Param>
+using AtomicTokenBucketContention = TokenBucketContention<Param>;
+template <class Param>
+using MutexTokenBucketContention = TokenBucketContention<Param>;
+
+using AtomicContentionTypes = testing::Types<
+    ContentionParam<true, 1>, ContentionParam<true, 2>,
+    ContentionParam<true, 4>, ContentionParam<true, 8>,
+    ContentionParam<true, 16>, ContentionParam<true, 32>,
+    ContentionParam<true, 64>>;
+using MutexContentionTypes = testing::Types<
+    ContentionParam<false, 1>, ContentionParam<false, 2>,
+    ContentionParam<false, 4>, ContentionParam<false, 8>,
+    ContentionParam<false, 16>, ContentionParam<false, 32>,
+    ContentionParam<false, 64>>;
+TYPED_TEST_CASE(AtomicTokenBucketContention, AtomicContentionTypes);
+TYPED_TEST_CASE(MutexTokenBucketContention, MutexContentionTypes);
+
+TYPED_PERF_TEST(AtomicTokenBucketContention, Get) {
+  this->Get();
+}
+
+TYPED_PERF_TEST(MutexTokenBucketContention, Get) {
+  this->Get();
+}
+
+TEST(ShardedTokenBucketTest, Get) {
+  ccb::ShardedTokenBucket stb(1000, 100, 10);
+  size_t got = 0;
+  for (int i = 0; i < 200; i++) {
+    if (stb.Get(1)) got++;
+  }
+  ASSERT_LE(100UL, got);
+  ASSERT_GE(110UL, got);
+  ASSERT_FALSE(stb.Get(20));
+}
+
+TEST(ShardedTokenBucketTest, HugeShardTokens) {
+  // the borrowed batch is bounded by the bucket size rather than wrapping
+  ccb::ShardedTokenBucket stb(1, 100, UINT32_MAX);
+  size_t got = 0;
+  for (int i = 0; i < 200; i++) {
+    if (stb.Get(1)) got++;
+  }
+  ASSERT_EQ(100UL, got);
+}
+
+TEST(ShardedTokenBucketTest, Rebalance) {
+  ccb::ShardedTokenBucket stb(1, 100, 50);
+  std::thread([&stb] {
+    ASSERT_TRUE(stb.Get(1));
+  }).join();
+  // the exited thread has returned its shard tokens
+  ASSERT_LE(99U, stb.tokens());
+  ASSERT_TRUE(stb.Get(1));
+  ASSERT_LE(98U, stb.tokens());
+  // the first call only marks the shard idle
+  stb.Rebalance();
+  stb.Rebalance();
+  std::thread([&stb] {
+    ASSERT_TRUE(stb.Get(98));
+  }).join();
+}
+
+TEST(ShardedTokenBucketTest, RateBound) {
+  constexpr uint32_t kRate = 100000;
+  constexpr uint32_t kShardTokens = 100;
+  constexpr size_t kThreads = 8;
+  ccb::ShardedTokenBucket stb(kRate, kRate / 10, kShardTokens);
+  std::atomic<size_t> got{0};
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t t = 0; t < kThreads; t++) {
+    workers.emplace_back([&] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        if (stb.Get(1)) {
+          got.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  stop = true;
+  for (auto& w : workers) {
+    w.join();
+  }
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  size_t limit = kRate / 10 + kRate * us / 1000000 + kShardTokens * kThreads;
+  ASSERT_GE(limit, got.load());
+}
+
+PERF_TEST(ShardedTokenBucketPerf, Get) {
+  static ccb::ShardedTokenBucket stb(1000000000, 1000000000, 1000);
+  stb.Get(1);
+}
+
+TEST(HierarchicalTokenBucketTest, Borrow) {
+  ccb::HierarchicalTokenBucket htb(1, 100);
+  auto tenant = htb.AddNode(htb.root(), 1, 50);
+  auto user1 = htb.AddNode(tenant, 1, 10);
+  auto user2 = htb.AddNode(tenant, 1, 10, 1, 20);
+  // own tokens, charged to the ancestors as well
+  ASSERT_TRUE(htb.Get(user1, 10));
+  ASSERT_EQ(0U, htb.tokens(user1));
+  ASSERT_EQ(40U, htb.tokens(tenant));
+  ASSERT_EQ(90U, htb.tokens(htb.root()));
+  // borrow from the tenant
+  ASSERT_TRUE(htb.Get(user1, 30));
+  ASSERT_EQ(10U, htb.tokens(tenant));
+  ASSERT_EQ(60U, htb.tokens(htb.root()));
+  // borrow from the root
+  ASSERT_TRUE(htb.Check(user1, 50));
+  ASSERT_TRUE(htb.Get(user1, 50));
+  ASSERT_EQ(10U, htb.tokens(htb.root()));
+  ASSERT_FALSE(htb.Get(user1, 20));
+  ASSERT_FALSE(htb.Check(user1, 20));
+  ASSERT_EQ(10U, htb.tokens(htb.root()));
+  // user2 is limited by its ceil
+  ASSERT_TRUE(htb.Get(user2, 10));
+  ASSERT_FALSE(htb.Check(user2, 15));
+  ASSERT_FALSE(htb.Get(user2, 15));
+}
+
+TEST(HierarchicalTokenBucketTest, Rollback) {
+  ccb::HierarchicalTokenBucket htb(1, 5);
+  auto tenant = htb.AddNode(htb.root(), 1, 1, 1, 20);
+  auto user = htb.AddNode(tenant, 1, 1, 1, 20);
+  ASSERT_TRUE(htb.Get(user, 1));
+  ASSERT_EQ(19U, user->ceil->tokens());
+  ASSERT_EQ(19U, tenant->ceil->tokens());
+  ASSERT_EQ(4U, htb.tokens(htb.root()));
+  // fails at the root, the ceil tokens taken below are put back
+  ASSERT_FALSE(htb.Get(user, 10));
+  ASSERT_EQ(19U, user->ceil->tokens());
+  ASSERT_EQ(19U, tenant->ceil->tokens());
+  ASSERT_EQ(4U, htb.tokens(htb.root()));
+  ASSERT_THROW(htb.AddNode(nullptr, 1, 1), std::invalid_argument);
+}
+
+TEST(HierarchicalTokenBucketTest, AncestorCeil) {
+  ccb::HierarchicalTokenBucket htb(1, 100);
+  auto tenant = htb.AddNode(htb.root(), 1, 50, 1, 5);
+  auto user = htb.AddNode(tenant, 1, 20);
+  // the user has the tokens but the tenant above is capped
+  ASSERT_FALSE(htb.Check(user, 10));
+  ASSERT_FALSE(htb.Get(user, 10));
+  ASSERT_EQ(20U, htb.tokens(user));
+  ASSERT_EQ(5U, tenant->ceil->tokens());
+  ASSERT_TRUE(htb.Check(user, 5));
+  ASSERT_TRUE(htb.Get(user, 5));
+  ASSERT_EQ(15U, htb.tokens(user));
+  ASSERT_EQ(45U, htb.tokens(tenant));
+  ASSERT_EQ(0U, tenant->ceil->tokens());
+  ASSERT_EQ(95U, htb.tokens(htb.root()));
+  ASSERT_FALSE(htb.Get(user, 1));
+  ASSERT_EQ(15U, htb.tokens(user));
+}
+
+PERF_TEST(HierarchicalTokenBucketPerf, Get) {
+  static ccb::HierarchicalTokenBucket htb(1000000000, 1000000000);
+  static auto tenant = htb.AddNode(htb.root(), 1000000000, 1000000000);
+  static auto user = htb.AddNode(tenant, 1000000000, 1000000000);
+  static auto endpoint = htb.AddNode(user, 1000000000, 1000000000);
+  htb.Get(endpoint, 1);
+}
+
+TEST(AsyncTokenBucketTest, AcquireAsync) {
+  ccb::TimerWheel timer_wheel(1000, true);
+  ccb::AsyncTokenBucket atb(1000, 10, &timer_wheel);
+  std::vector<int> order;
+  for (int i = 0; i < 10; i++) {
+    atb.AcquireAsync(1, [&order, i] { order.push_back(i); });
+  }
+  ASSERT_EQ(10UL, order.size());
+  ASSERT_EQ(0UL, atb.waiters());
+  ASSERT_LT(0UL, atb.TimeUntil(1));
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 10; i < 30; i++) {
+    atb.AcquireAsync(i % 2 ? 1 : 3, [&order, i] { order.push_back(i); });
+  }
+  ASSERT_EQ(20UL, atb.waiters());
+  ASSERT_THROW(atb.AcquireAsync(11, [] {}), std::invalid_argument);
+  while (atb.waiters() > 0) {
+    usleep(1000);
+    timer_wheel.MoveOn();
+  }
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  // 40 tokens at 1000/s
+  ASSERT_LE(39, ms);
+  ASSERT_GT(200, ms);
+  ASSERT_EQ(30UL, order.size());
+  for (int i = 0; i < 30; i++) {
+    ASSERT_EQ(i, order[i]);
+  }
+}
@@ -65,6 +65,27 @@ TEST_F(DispatchQueueTest, UnregisterProducer) {
   ASSERT_EQ(2, val);
 }
 
+TEST(DispatchQueueReserveTest, ReserveQueues) {
+  ccb::DispatchQueue<int> dispatch_queue(16);
+  auto consumer = dispatch_queue.RegisterConsumer();
+  consumer->ReserveQueues(2);
+  // the first two producers take the reserved queues, the third allocates
+  ccb::DispatchQueue<int>::OutQueue* producers[3];
+  for (auto& producer : producers) {
+    producer = dispatch_queue.RegisterProducer();
+    ASSERT_NE(nullptr, producer);
+  }
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(producers[i]->Push(0, i));
+  }
+  int val = 0, sum = 0;
+  while (consumer->Pop(&val)) {
+    sum += val + 1;
+  }
+  ASSERT_EQ(6, sum);
+  consumer->ReserveQueues(1);
+}
+
 PERF_TEST_F(DispatchQueueTest, OneshotProducer) {
   static auto producer = dispatch_queue_.RegisterProducer();
   static auto consumer = dispatch_queue_.RegisterConsumer();
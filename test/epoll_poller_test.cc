@@ -0,0 +1,108 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include "gtestx/gtestx.h"
+#include "ccbase/eventfd.h"
+#include "ccbase/epoll_poller.h"
+
+class EpollPollerTest : public testing::Test {
+ protected:
+  ccb::EpollPoller poller_;
+  ccb::EventFd efd_;
+  int val_ = 0;
+};
+
+TEST_F(EpollPollerTest, FdEvent) {
+  ASSERT_TRUE(poller_.AddFd(efd_.fd(), EPOLLIN, [this](uint32_t events) {
+    if (events & EPOLLIN) efd_.Get();
+    val_++;
+  }));
+  ASSERT_FALSE(poller_.AddFd(efd_.fd(), EPOLLIN, [](uint32_t) {}));
+  poller_.Poll(0);
+  ASSERT_EQ(0, val_);
+  efd_.Notify();
+  poller_.Poll(10);
+  ASSERT_EQ(1, val_);
+  ASSERT_TRUE(poller_.ModFd(efd_.fd(), EPOLLOUT));
+  poller_.Poll(0);
+  ASSERT_EQ(2, val_);
+  ASSERT_TRUE(poller_.DelFd(efd_.fd()));
+  ASSERT_FALSE(poller_.DelFd(efd_.fd()));
+  ASSERT_FALSE(poller_.ModFd(efd_.fd(), EPOLLIN));
+  efd_.Notify();
+  poller_.Poll(0);
+  ASSERT_EQ(2, val_);
+}
+
+TEST_F(EpollPollerTest, DelFdInHandler) {
+  ASSERT_TRUE(poller_.AddFd(efd_.fd(), EPOLLIN, [this](uint32_t) {
+    val_++;
+    poller_.DelFd(efd_.fd());
+  }));
+  efd_.Notify();
+  poller_.Poll(0);
+  poller_.Poll(0);
+  ASSERT_EQ(1, val_);
+}
+
+TEST_F(EpollPollerTest, Wakeup) {
+  std::thread t([this] {
+    usleep(10000);
+    poller_.Wakeup();
+  });
+  poller_.Poll(ccb::WorkerGroup::Poller::kInfiniteTimeout);
+  t.join();
+  // wakeup before poll is not lost
+  poller_.Wakeup();
+  poller_.Poll(ccb::WorkerGroup::Poller::kInfiniteTimeout);
+}
+
+TEST(EpollPollerWorkerTest, WakeupIdleWorker) {
+  ccb::WorkerGroup worker_group{1, 1000};
+  std::atomic_int val{0};
+  // let the worker fall asleep
+  usleep(10000);
+  for (int i = 0; i < 100; i++) {
+    worker_group.PostTask([&val] {
+      val++;
+    });
+    for (int j = 0; j < 1000 && val <= i; j++) {
+      usleep(100);
+    }
+    ASSERT_EQ(i + 1, val);
+  }
+}
+
+PERF_TEST_F(EpollPollerTest, WakeupAndPoll) {
+  poller_.Wakeup();
+  poller_.Poll(0);
+}
@@ -0,0 +1,213 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include "gtestx/gtestx.h"
+#include "ccbase/io_uring_poller.h"
+
+class IoUringPollerTest : public testing::Test {
+ protected:
+  void SetUp() {
+    try {
+      poller_.reset(new ccb::IoUringPoller(8));
+    } catch (const std::system_error& e) {
+      fprintf(stderr, "io_uring not available: %s\n", e.what());
+    }
+  }
+  std::unique_ptr<ccb::IoUringPoller> poller_;
+};
+
+#define SKIP_IF_NO_IO_URING() do { if (!poller_) return; } while (0)
+
+TEST_F(IoUringPollerTest, ReadWrite) {
+  SKIP_IF_NO_IO_URING();
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  char wbuf[] = "hello";
+  char rbuf[16] = {0};
+  int wres = 0, rres = 0;
+  ASSERT_TRUE(poller_->Read(fds[0], rbuf, sizeof(rbuf), -1, [&rres](int res) {
+    rres = res;
+  }));
+  ASSERT_TRUE(poller_->Write(fds[1], wbuf, 5, -1, [&wres](int res) {
+    wres = res;
+  }));
+  for (int i = 0; i < 100 && (!rres || !wres); i++) {
+    poller_->Poll(10);
+  }
+  ASSERT_EQ(5, wres);
+  ASSERT_EQ(5, rres);
+  ASSERT_STREQ("hello", rbuf);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(IoUringPollerTest, AcceptRecvSend) {
+  SKIP_IF_NO_IO_URING();
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_LE(0, lfd);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  ASSERT_EQ(0, bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+  ASSERT_EQ(0, listen(lfd, 16));
+  socklen_t len = sizeof(addr);
+  ASSERT_EQ(0, getsockname(lfd, reinterpret_cast<sockaddr*>(&addr), &len));
+
+  int afd = -1;
+  char rbuf[16] = {0};
+  int rres = 0;
+  ASSERT_TRUE(poller_->Accept(lfd, nullptr, nullptr, [&](int res) {
+    afd = res;
+    ASSERT_TRUE(poller_->Recv(afd, rbuf, sizeof(rbuf), 0, [&rres](int res) {
+      rres = res;
+    }));
+  }));
+  poller_->Submit();
+  int cfd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_EQ(0, connect(cfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+  int sres = 0;
+  ASSERT_TRUE(poller_->Send(cfd, "ping", 4, 0, [&sres](int res) {
+    sres = res;
+  }));
+  for (int i = 0; i < 100 && (!rres || !sres); i++) {
+    poller_->Poll(10);
+  }
+  ASSERT_LE(0, afd);
+  ASSERT_EQ(4, sres);
+  ASSERT_EQ(4, rres);
+  ASSERT_STREQ("ping", rbuf);
+  close(afd);
+  close(cfd);
+  close(lfd);
+}
+
+TEST_F(IoUringPollerTest, RingFull) {
+  SKIP_IF_NO_IO_URING();
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  char rbuf[64];
+  int count = 0;
+  // more requests than ring entries are flushed to kernel in batch
+  for (int i = 0; i < 64; i++) {
+    ASSERT_TRUE(poller_->Read(fds[0], rbuf + i, 1, -1, [&count](int res) {
+      if (res == 1) count++;
+    }));
+  }
+  char wbuf[64] = {0};
+  ASSERT_EQ(64, write(fds[1], wbuf, sizeof(wbuf)));
+  for (int i = 0; i < 100 && count < 64; i++) {
+    poller_->Poll(10);
+  }
+  ASSERT_EQ(64, count);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(IoUringPollerTest, Wakeup) {
+  SKIP_IF_NO_IO_URING();
+  std::thread t([this] {
+    usleep(10000);
+    poller_->Wakeup();
+  });
+  poller_->Poll(ccb::WorkerGroup::Poller::kInfiniteTimeout);
+  t.join();
+  poller_->Wakeup();
+  poller_->Poll(ccb::WorkerGroup::Poller::kInfiniteTimeout);
+}
+
+TEST_F(IoUringPollerTest, WakeupWithFullRing) {
+  SKIP_IF_NO_IO_URING();
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  char rbuf[64];
+  int count = 0;
+  // the wakeup must be re-armed each round while requests keep the ring full
+  for (int round = 0; round < 8; round++) {
+    for (int i = 0; i < 8; i++) {
+      ASSERT_TRUE(poller_->Read(fds[0], rbuf + i, 1, -1, [&count](int res) {
+        if (res == 1) count++;
+      }));
+    }
+    std::thread t([this] {
+      usleep(1000);
+      poller_->Wakeup();
+    });
+    poller_->Poll(ccb::WorkerGroup::Poller::kInfiniteTimeout);
+    t.join();
+  }
+  char wbuf[64] = {0};
+  ASSERT_EQ(64, write(fds[1], wbuf, sizeof(wbuf)));
+  for (int i = 0; i < 100 && count < 64; i++) {
+    poller_->Poll(10);
+  }
+  ASSERT_EQ(64, count);
+  poller_->Wakeup();
+  poller_->Poll(ccb::WorkerGroup::Poller::kInfiniteTimeout);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(IoUringPollerTest, WorkerGroup) {
+  SKIP_IF_NO_IO_URING();
+  ccb::WorkerGroup worker_group{2, 1000, [](size_t) {
+    return std::make_shared<ccb::IoUringPoller>();
+  }};
+  std::atomic_int val{0};
+  usleep(10000);
+  for (size_t i = 0; i < worker_group.size(); i++) {
+    worker_group.PostTask(i, [&val] {
+      auto poller = static_cast<ccb::IoUringPoller*>(
+          ccb::WorkerGroup::Worker::self()->poller());
+      static const char kMsg[] = "x";
+      poller->Write(STDERR_FILENO, kMsg, 0, -1, [&val](int res) {
+        if (res == 0) val++;
+      });
+    });
+  }
+  for (int i = 0; i < 100 && val < 2; i++) {
+    usleep(1000);
+  }
+  ASSERT_EQ(2, val);
+}
+
+PERF_TEST_F(IoUringPollerTest, WakeupAndPoll) {
+  SKIP_IF_NO_IO_URING();
+  poller_->Wakeup();
+  poller_->Poll(ccb::WorkerGroup::Poller::kInfiniteTimeout);
+}
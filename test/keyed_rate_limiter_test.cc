@@ -0,0 +1,233 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "gtestx/gtestx.h"
+#include "ccbase/keyed_rate_limiter.h"
+
+TEST(KeyedRateLimiterTest, Get) {
+  ccb::KeyedRateLimiter limiter(1000, 10, 1000, 1000);
+  for (uint64_t key : {0UL, 1UL, 2UL}) {
+    for (int i = 0; i < 10; i++) {
+      ASSERT_TRUE(limiter.Get(key)) << key;
+    }
+  }
+  ASSERT_FALSE(limiter.Get(0));
+  ASSERT_FALSE(limiter.Get(1));
+  ASSERT_FALSE(limiter.Check(2, 1));
+  ASSERT_TRUE(limiter.Check(3, 10));
+  ASSERT_FALSE(limiter.Get(3, 11));
+  ASSERT_EQ(3UL, limiter.size());
+  usleep(5000);
+  ASSERT_TRUE(limiter.Get(1, 4));
+  ASSERT_TRUE(limiter.Check(2, 4));
+}
+
+TEST(KeyedRateLimiterTest, Evict) {
+  constexpr size_t kKeys = 10000;
+  ccb::KeyedRateLimiter limiter(100, 10, kKeys, 20, nullptr, 0, 16);
+  for (uint64_t key = 0; key < kKeys; key++) {
+    ASSERT_TRUE(limiter.Get(key * 7, 10));
+  }
+  ASSERT_EQ(kKeys, limiter.size());
+  usleep(10000);
+  // refresh the odd keys
+  for (uint64_t key = 1; key < kKeys; key += 2) {
+    ASSERT_TRUE(limiter.Get(key * 7));
+  }
+  usleep(12000);
+  limiter.Evict();
+  ASSERT_EQ(kKeys / 2, limiter.size());
+  // remaining keys are still found after the backward shifts
+  for (uint64_t key = 1; key < kKeys; key += 2) {
+    ASSERT_FALSE(limiter.Get(key * 7, 10)) << key;
+  }
+  // evicted keys come back with a full bucket
+  ASSERT_TRUE(limiter.Get(2 * 7, 10));
+}
+
+TEST(KeyedRateLimiterTest, MaxKeys) {
+  ccb::KeyedRateLimiter limiter(1000, 10, 64, 20, nullptr, 0, 1);
+  for (uint64_t key = 0; key < 64; key++) {
+    ASSERT_TRUE(limiter.Get(key));
+  }
+  ASSERT_FALSE(limiter.Get(64));
+  ASSERT_TRUE(limiter.Get(0));
+  usleep(25000);
+  // idle keys make room for the new one
+  ASSERT_TRUE(limiter.Get(64));
+  ASSERT_EQ(1UL, limiter.size());
+}
+
+TEST(KeyedRateLimiterTest, TimerWheelEvict) {
+  ccb::TimerWheel timer_wheel(1000, false);
+  ccb::KeyedRateLimiter limiter(1000, 10, 1000, 10, &timer_wheel, 2, 4);
+  for (uint64_t key = 0; key < 100; key++) {
+    limiter.Get(key);
+  }
+  ASSERT_EQ(100UL, limiter.size());
+  for (int i = 0; i < 30; i++) {
+    usleep(1000);
+    timer_wheel.MoveOn();
+  }
+  ASSERT_EQ(0UL, limiter.size());
+}
+
+TEST(KeyedRateLimiterTest, MultiThread) {
+  constexpr size_t kThreads = 4;
+  constexpr uint64_t kKeys = 1000;
+  ccb::KeyedRateLimiter limiter(1, 100, kKeys, 60000);
+  std::atomic<size_t> got{0};
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < kThreads; t++) {
+    workers.emplace_back([&] {
+      for (int i = 0; i < 100; i++) {
+        for (uint64_t key = 0; key < kKeys; key++) {
+          if (limiter.Get(key)) got++;
+        }
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  // each key grants its bucket plus at most a token refilled meanwhile
+  ASSERT_LE(kKeys * 100, got.load());
+  ASSERT_GE(kKeys * 101, got.load());
+}
+
+TEST(KeyedRateLimiterTest, HotKey) {
+  constexpr size_t kThreads = 8;
+  for (auto algorithm : {ccb::KeyedRateLimiter::Algorithm::kTokenBucket,
+                         ccb::KeyedRateLimiter::Algorithm::kGcra}) {
+    // a token per second, evicting keys meanwhile must not refill them
+    ccb::KeyedRateLimiter limiter(1, 1, 1000, 1000, nullptr, 0, 1,
+                                  algorithm);
+    std::atomic<size_t> got{0};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < kThreads; t++) {
+      workers.emplace_back([&, t] {
+        while (!stop) {
+          if (limiter.Get(1)) got++;
+          if (t == 0) limiter.Evict();
+        }
+      });
+    }
+    usleep(500000);
+    stop = true;
+    for (auto& w : workers) {
+      w.join();
+    }
+    // the full bucket and at most a refilled token
+    ASSERT_LE(1UL, got.load());
+    ASSERT_GE(2UL, got.load());
+  }
+}
+
+TEST(KeyedRateLimiterTest, Gcra) {
+  // the bucket is too large for kTokenBucket
+  constexpr uint32_t kBucketSize = ccb::KeyedRateLimiter::kMaxBucketSize * 2;
+  ccb::KeyedRateLimiter limiter(1000, kBucketSize, 1000, 20, nullptr, 0, 4,
+                                ccb::KeyedRateLimiter::Algorithm::kGcra);
+  for (uint64_t key : {0UL, 1UL, 2UL}) {
+    ASSERT_TRUE(limiter.Check(key, kBucketSize)) << key;
+    ASSERT_TRUE(limiter.Get(key, kBucketSize)) << key;
+    ASSERT_FALSE(limiter.Get(key)) << key;
+  }
+  ASSERT_FALSE(limiter.Get(3, kBucketSize + 1));
+  ASSERT_EQ(3UL, limiter.size());
+  usleep(5000);
+  ASSERT_TRUE(limiter.Get(1, 4));
+  ASSERT_FALSE(limiter.Check(1, 100));
+  // keys are idle only after paying back their debt
+  usleep(25000);
+  limiter.Evict();
+  ASSERT_EQ(3UL, limiter.size());
+  ASSERT_TRUE(limiter.Get(2, 10));
+  ASSERT_FALSE(limiter.Get(2, 100));
+}
+
+TEST(KeyedRateLimiterTest, GcraEvict) {
+  // the bucket is refilled in 100 ms
+  ccb::KeyedRateLimiter limiter(100, 10, 1000, 50, nullptr, 0, 4,
+                                ccb::KeyedRateLimiter::Algorithm::kGcra);
+  for (uint64_t key = 0; key < 100; key++) {
+    ASSERT_TRUE(limiter.Get(key, 10));
+  }
+  ASSERT_EQ(100UL, limiter.size());
+  // the idle time counts after the bucket is full again
+  usleep(60000);
+  limiter.Evict();
+  ASSERT_EQ(100UL, limiter.size());
+  usleep(100000);
+  limiter.Evict();
+  ASSERT_EQ(0UL, limiter.size());
+}
+
+TEST(KeyedRateLimiterTest, LongIdle) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  for (auto algorithm : {ccb::KeyedRateLimiter::Algorithm::kTokenBucket,
+                         ccb::KeyedRateLimiter::Algorithm::kGcra}) {
+    struct timeval tv = {ts.tv_sec + 1, 0};
+    ccb::KeyedRateLimiter limiter(1, 10, 1000, 1000, nullptr, 0, 1,
+                                  algorithm);
+    ASSERT_TRUE(limiter.Get(1, 10, &tv));
+    ASSERT_TRUE(limiter.Get(2, 10, &tv));
+    // more than 2^31 ms later, key 1 is refilled and key 2 is evicted
+    tv.tv_sec += 30 * 86400;
+    ASSERT_TRUE(limiter.Check(1, 10, &tv));
+    ASSERT_TRUE(limiter.Get(1, 10, &tv));
+    ASSERT_FALSE(limiter.Get(1, 1, &tv));
+    limiter.Evict(&tv);
+    ASSERT_EQ(1UL, limiter.size());
+  }
+  // a GCRA key accessed at least once in 52 days never wraps
+  struct timeval tv = {ts.tv_sec + 1, 0};
+  ccb::KeyedRateLimiter limiter(1, 10, 1000, 1000, nullptr, 0, 1,
+                                ccb::KeyedRateLimiter::Algorithm::kGcra);
+  ASSERT_TRUE(limiter.Get(1, 10, &tv));
+  tv.tv_sec += 60 * 86400;
+  ASSERT_TRUE(limiter.Check(1, 10, &tv));
+  tv.tv_sec += 50 * 86400;
+  ASSERT_TRUE(limiter.Check(1, 10, &tv));
+  limiter.Evict(&tv);
+  ASSERT_EQ(0UL, limiter.size());
+}
+
+PERF_TEST(KeyedRateLimiterPerf, Get) {
+  static ccb::KeyedRateLimiter limiter(1000000, 1000000, 1000000, 60000);
+  static uint64_t key = 0;
+  limiter.Get(key++ % 100000);
+}
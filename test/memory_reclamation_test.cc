@@ -29,8 +29,10 @@
  */
 #include <unistd.h>
 #include <atomic>
+#include <memory>
 #include <thread>
 #include <type_traits>
+#include <vector>
 #include "gtestx/gtestx.h"
 #include "ccbase/memory_reclamation.h"
 
@@ -170,3 +172,443 @@ TYPED_PERF_TEST(MemoryReclamationPerfTest, RetirePerf) {
   auto old_ptr = this->ptr_.exchange(new TraceableObj);
   if (old_ptr) this->recl_.Retire(old_ptr);
 }
+
+TEST(EpochBasedReclamationTest, AmortizedEpochUpdate) {
+  using EBR = ccb::EpochBasedReclamation<TraceableObj, TraceableObj, 32>;
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+  for (int i = 0; i < 10000; i++) {
+    EBR::Retire(new TraceableObj);
+    // epoch is advanced every 32 retires and objects of 2 epochs are kept
+    ASSERT_GE(3 * 32, TraceableObj::allocated_objs()) << i;
+  }
+  EBR::RetireCleanup();
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+struct CountedEntry {
+  int val;
+  static int reclaimed;
+
+  CountedEntry() = default;
+  explicit CountedEntry(int v) : val(v) {}
+  void Reclaim() {
+    reclaimed++;
+  }
+};
+int CountedEntry::reclaimed = 0;
+
+TEST(RetireListTest, ChunkedList) {
+  ccb::RetireChunkPool<CountedEntry> pool;
+  ccb::RetireList<CountedEntry> rlist(&pool);
+  CountedEntry::reclaimed = 0;
+  for (int i = 0; i < 1000; i++) {
+    rlist.emplace_back(i);
+  }
+  ASSERT_EQ(1000, rlist.size());
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(i, rlist.front().val);
+    rlist.pop_front();
+  }
+  // survivors keep their order across chunks
+  rlist.remove_if([](const CountedEntry& e) { return e.val % 3 != 0; });
+  ASSERT_EQ(330, rlist.size());
+  ASSERT_EQ(670, CountedEntry::reclaimed);
+  ccb::RetireList<CountedEntry> other;
+  other.emplace_back(1000);
+  rlist.splice(&other);
+  ASSERT_TRUE(other.empty());
+  for (int i = 12; i < 1000; i += 3) {
+    ASSERT_EQ(i, rlist.front().val);
+    rlist.pop_front();
+  }
+  ASSERT_EQ(1000, rlist.front().val);
+  rlist.pop_front();
+  ASSERT_TRUE(rlist.empty());
+  ASSERT_EQ(1001, CountedEntry::reclaimed);
+}
+
+template <class RType>
+class RetireAllocTest : public testing::Test {
+ protected:
+  void SetUp() {
+    ASSERT_EQ(0, TraceableObj::allocated_objs());
+  }
+  void TearDown() {
+    RType::RetireCleanup();
+    ASSERT_EQ(0, TraceableObj::allocated_objs());
+  }
+};
+using RetireAllocTestTypes = testing::Types<
+    ccb::EpochBasedReclamation<TraceableObj, CountedEntry>,
+    ccb::HazardPtrReclamation<TraceableObj, CountedEntry>,
+    ccb::QSBRReclamation<TraceableObj, CountedEntry>>;
+TYPED_TEST_CASE(RetireAllocTest, RetireAllocTestTypes);
+
+TYPED_TEST(RetireAllocTest, LargeDeleter) {
+  std::atomic<size_t> deleted{0};
+  size_t weight = 2;
+  auto deleter = [&deleted, weight](TraceableObj* p) {
+    deleted += weight;
+    delete p;
+  };
+  for (int i = 0; i < 100; i++) {
+    TypeParam::Retire(new TraceableObj, deleter);
+  }
+  TypeParam::RetireCleanup();
+  ASSERT_EQ(200, deleted.load());
+}
+
+struct ReclaimerScope {};
+
+template <class RType>
+class ReclaimerServiceTest : public testing::Test {
+ protected:
+  void SetUp() {
+    ASSERT_EQ(0, TraceableObj::allocated_objs());
+    RType::SetReclaimerService(&reclaimer_);
+  }
+  void TearDown() {
+    RType::SetReclaimerService(nullptr);
+    ASSERT_EQ(0, TraceableObj::allocated_objs());
+  }
+  ccb::ReclaimerService reclaimer_;
+};
+using ReclaimerTestTypes = testing::Types<
+    ccb::EpochBasedReclamation<TraceableObj, ReclaimerScope>,
+    ccb::HazardPtrReclamation<TraceableObj, ReclaimerScope>>;
+TYPED_TEST_CASE(ReclaimerServiceTest, ReclaimerTestTypes);
+
+TYPED_TEST(ReclaimerServiceTest, ReclaimOffThread) {
+  std::thread::id writer_id = std::this_thread::get_id();
+  std::atomic<size_t> reclaimed_in_writer{0};
+  auto deleter = [writer_id, &reclaimed_in_writer](TraceableObj* p) {
+    reclaimed_in_writer += (std::this_thread::get_id() == writer_id);
+    delete p;
+  };
+  for (int i = 0; i < 1000; i++) {
+    TypeParam::Retire(new TraceableObj, deleter);
+  }
+  TypeParam::RetireCleanup();
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+  ASSERT_EQ(0, this->reclaimer_.backlog());
+  ASSERT_EQ(0, reclaimed_in_writer.load());
+}
+
+TYPED_TEST(ReclaimerServiceTest, Detach) {
+  for (int i = 0; i < 100; i++) {
+    TypeParam::Retire(new TraceableObj);
+  }
+  TypeParam::SetReclaimerService(nullptr);
+  for (int i = 0; i < 100; i++) {
+    TypeParam::Retire(new TraceableObj);
+  }
+  TypeParam::RetireCleanup();
+  this->reclaimer_.Flush();
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+TYPED_TEST(ReclaimerServiceTest, DetachWhileRetiring) {
+  TypeParam::SetReclaimerService(nullptr);
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> writers;
+  for (int i = 0; i < 2; i++) {
+    writers.emplace_back([&stop] {
+      while (!stop) {
+        TypeParam::Retire(new TraceableObj);
+      }
+      TypeParam::RetireCleanup();
+    });
+  }
+  // a service may be destroyed as soon as it is detached
+  for (int i = 0; i < 20; i++) {
+    std::unique_ptr<ccb::ReclaimerService> reclaimer(
+        new ccb::ReclaimerService(ccb::ReclaimerService::kBatchSize * 4, 100));
+    TypeParam::SetReclaimerService(reclaimer.get());
+    usleep(1000);
+    TypeParam::SetReclaimerService(nullptr);
+  }
+  stop = true;
+  for (auto& writer : writers) {
+    writer.join();
+  }
+}
+
+TEST(ReclaimerServiceTest, Backpressure) {
+  ccb::ReclaimerService reclaimer(100, 100);
+  std::atomic<bool> release{false};
+  std::atomic<size_t> submitted{0};
+  auto job = [&release] {
+    return release.load();
+  };
+  std::thread writer([&] {
+    for (int i = 0; i < 10; i++) {
+      reclaimer.Submit(30, job);
+      submitted++;
+    }
+  });
+  for (int i = 0; i < 1000 && submitted < 3; i++) {
+    usleep(1000);
+  }
+  // backlog is bounded so the writer stays blocked
+  for (int i = 0; i < 20; i++) {
+    EXPECT_EQ(3, submitted.load());
+    EXPECT_EQ(90, reclaimer.backlog());
+    usleep(1000);
+  }
+  release = true;
+  writer.join();
+  reclaimer.Flush();
+  ASSERT_EQ(10, submitted.load());
+  ASSERT_EQ(0, reclaimer.backlog());
+}
+
+TEST(ReclaimerServiceTest, CompleteOnDestroy) {
+  std::atomic<int> runs{0};
+  {
+    ccb::ReclaimerService reclaimer;
+    reclaimer.Submit(1, [&runs] {
+      return ++runs >= 3;
+    });
+  }
+  ASSERT_EQ(3, runs.load());
+}
+
+TEST(ReclaimerServiceTest, FlushOwnJobs) {
+  ccb::ReclaimerService reclaimer(100, 100);
+  std::atomic<bool> release_first{false};
+  std::atomic<bool> release_later{false};
+  std::atomic<bool> flushed{false};
+  reclaimer.Submit(1, [&release_first] {
+    return release_first.load();
+  });
+  std::thread flusher([&] {
+    reclaimer.Flush();
+    flushed = true;
+  });
+  usleep(10000);
+  // submitted after Flush was called so it is not waited for
+  reclaimer.Submit(1, [&release_later] {
+    return release_later.load();
+  });
+  release_first = true;
+  for (int i = 0; i < 1000 && !flushed; i++) {
+    usleep(1000);
+  }
+  ASSERT_TRUE(flushed.load());
+  ASSERT_EQ(1, reclaimer.backlog());
+  release_later = true;
+  flusher.join();
+  reclaimer.Flush();
+  ASSERT_EQ(0, reclaimer.backlog());
+}
+
+TEST(ReclaimerServiceTest, EBRRetireInReadSection) {
+  using RType = ccb::EpochBasedReclamation<TraceableObj, ReclaimerScope>;
+  ccb::ReclaimerService reclaimer(ccb::ReclaimerService::kBatchSize, 100);
+  RType::SetReclaimerService(&reclaimer);
+  RType::ReadLock();
+  // the writer holds the epoch back, so the backlog has to overflow
+  for (size_t i = 0; i < ccb::ReclaimerService::kBatchSize * 10; i++) {
+    RType::Retire(new TraceableObj);
+  }
+  ASSERT_LT(ccb::ReclaimerService::kBatchSize, reclaimer.backlog());
+  RType::ReadUnlock();
+  RType::RetireCleanup();
+  RType::SetReclaimerService(nullptr);
+  ASSERT_EQ(0, reclaimer.backlog());
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+TEST(ReclaimerServiceTest, RetireInOtherDomainReadSection) {
+  struct ScopeA {};
+  struct ScopeB {};
+  using ReaderType = ccb::EpochBasedReclamation<TraceableObj, ScopeA>;
+  using WriterType = ccb::HazardPtrReclamation<TraceableObj, ScopeB>;
+  ccb::ReclaimerService reclaimer(ccb::ReclaimerService::kBatchSize, 100);
+  ReaderType::SetReclaimerService(&reclaimer);
+  WriterType::SetReclaimerService(&reclaimer);
+  // a pending batch of the reader domain is held by the section
+  ReaderType::ReadLock();
+  for (size_t i = 0; i < ccb::ReclaimerService::kBatchSize; i++) {
+    ReaderType::Retire(new TraceableObj);
+  }
+  // so the other domain must not wait for backlog either
+  for (size_t i = 0; i < ccb::ReclaimerService::kBatchSize * 10; i++) {
+    WriterType::Retire(new TraceableObj);
+  }
+  ASSERT_LT(ccb::ReclaimerService::kBatchSize, reclaimer.backlog());
+  ASSERT_EQ(1U, ccb::ReclaimerService::LocalReadSections());
+  ReaderType::ReadUnlock();
+  ASSERT_EQ(0U, ccb::ReclaimerService::LocalReadSections());
+  ReaderType::RetireCleanup();
+  WriterType::RetireCleanup();
+  ReaderType::SetReclaimerService(nullptr);
+  WriterType::SetReclaimerService(nullptr);
+  ASSERT_EQ(0, reclaimer.backlog());
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+TEST(ReclaimerServiceTest, HazardPtrRetireInReadSection) {
+  using RType = ccb::HazardPtrReclamation<TraceableObj, ReclaimerScope>;
+  ccb::ReclaimerService reclaimer(ccb::ReclaimerService::kBatchSize, 100);
+  RType::SetReclaimerService(&reclaimer);
+  // the writer pins its first batch, so the backlog has to overflow
+  TraceableObj* ptr = new TraceableObj;
+  RType::ReadLock(ptr);
+  RType::Retire(ptr);
+  for (size_t i = 1; i < ccb::ReclaimerService::kBatchSize * 10; i++) {
+    RType::Retire(new TraceableObj);
+  }
+  ASSERT_LE(ccb::ReclaimerService::kBatchSize, reclaimer.backlog());
+  RType::ReadUnlock();
+  RType::RetireCleanup();
+  RType::SetReclaimerService(nullptr);
+  ASSERT_EQ(0, reclaimer.backlog());
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+class QSBRReclamationTest : public testing::Test {
+ protected:
+  QSBRReclamationTest() : ptr_(nullptr) {}
+
+  void SetUp() {
+    ASSERT_EQ(0, TraceableObj::allocated_objs());
+    ccb::QSBRDomain::Online();
+  }
+  void TearDown() {
+    // the test thread is registered by ReadLock, it should not hold up
+    // the reclamation in later tests
+    ccb::QSBRDomain::Offline();
+    ASSERT_EQ(0, TraceableObj::allocated_objs());
+  }
+  ccb::PtrReclamationAdapter<TraceableObj,
+                             ccb::QSBRReclamation<TraceableObj>> recl_;
+  std::atomic<TraceableObj*> ptr_;
+};
+
+TEST_F(QSBRReclamationTest, Simple) {
+  this->ptr_ = new TraceableObj;
+  TraceableObj* ptr = this->recl_.ReadLock(&this->ptr_);
+  ASSERT_EQ(1, ptr->val());
+  this->recl_.ReadUnlock();
+  ASSERT_TRUE(ccb::QSBRDomain::IsRegistered());
+  this->ptr_ = nullptr;
+  this->recl_.Retire(ptr);
+  ASSERT_EQ(1, TraceableObj::allocated_objs());
+  this->recl_.RetireCleanup();
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+TEST_F(QSBRReclamationTest, QuiescentState) {
+  this->ptr_ = new TraceableObj;
+  auto ptr = this->recl_.ReadLock(&this->ptr_);
+  std::thread t([this] {
+    auto ptr = this->ptr_.exchange(nullptr);
+    this->recl_.Retire(ptr);
+    this->recl_.RetireCleanup();
+  });
+  // the reference is kept until a quiescent state even after ReadUnlock
+  this->recl_.ReadUnlock();
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(1, TraceableObj::allocated_objs());
+    ASSERT_EQ(1, ptr->val());
+    usleep(10000);
+  }
+  ccb::QSBRDomain::QuiescentState();
+  t.join();
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+TEST_F(QSBRReclamationTest, Offline) {
+  this->ptr_ = new TraceableObj;
+  this->recl_.ReadLock(&this->ptr_);
+  this->recl_.ReadUnlock();
+  ccb::QSBRDomain::Offline();
+  std::thread([this] {
+    auto ptr = this->ptr_.exchange(nullptr);
+    this->recl_.Retire(ptr);
+    this->recl_.RetireCleanup();
+  }).join();
+  ccb::QSBRDomain::Online();
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+TEST_F(QSBRReclamationTest, CleanupWaitsForBlockedReader) {
+  this->ptr_ = new TraceableObj;
+  std::atomic<bool> read{false};
+  std::atomic<bool> go_offline{false};
+  std::thread reader([&] {
+    this->recl_.ReadLock(&this->ptr_);
+    this->recl_.ReadUnlock();
+    read = true;
+    // blocked without announcing a quiescent state
+    while (!go_offline) {
+      usleep(1000);
+    }
+    ccb::QSBRDomain::Offline();
+    while (go_offline) {
+      usleep(1000);
+    }
+  });
+  while (!read) {
+    usleep(1000);
+  }
+  std::atomic<bool> cleaned{false};
+  std::thread writer([&] {
+    this->recl_.Retire(this->ptr_.exchange(nullptr));
+    this->recl_.RetireCleanup();
+    cleaned = true;
+  });
+  for (int i = 0; i < 20; i++) {
+    ccb::QSBRDomain::QuiescentState();
+    usleep(1000);
+  }
+  // a registered thread holds reclamation until it goes offline
+  EXPECT_FALSE(cleaned.load());
+  EXPECT_EQ(1, TraceableObj::allocated_objs());
+  go_offline = true;
+  for (int i = 0; i < 1000 && !cleaned; i++) {
+    ccb::QSBRDomain::QuiescentState();
+    usleep(1000);
+  }
+  EXPECT_TRUE(cleaned.load());
+  writer.join();
+  go_offline = false;
+  reader.join();
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+TEST_F(QSBRReclamationTest, RetireByExitingThread) {
+  this->ptr_ = new TraceableObj;
+  this->recl_.ReadLock(&this->ptr_);
+  this->recl_.ReadUnlock();
+  // the exiting writer can not wait for us
+  std::thread([this] {
+    this->recl_.Retire(this->ptr_.exchange(nullptr));
+  }).join();
+  ASSERT_EQ(1, TraceableObj::allocated_objs());
+  this->recl_.RetireCleanup();
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+TEST_F(QSBRReclamationTest, AmortizedEpochAdvance) {
+  using QSBR = ccb::QSBRReclamation<TraceableObj, TraceableObj, 32>;
+  ccb::QSBRDomain::Register();
+  uint64_t epoch = ccb::QSBRDomain::CurrentEpoch();
+  for (int i = 0; i < 3200; i++) {
+    QSBR::Retire(new TraceableObj);
+    ccb::QSBRDomain::QuiescentState();
+    // epoch is advanced and objects are reclaimed every 32 retires
+    ASSERT_GE(2 * 32, TraceableObj::allocated_objs()) << i;
+  }
+  // rather than once per retire
+  ASSERT_GE(epoch + 3200 / 32, ccb::QSBRDomain::CurrentEpoch());
+  QSBR::RetireCleanup();
+  ASSERT_EQ(0, TraceableObj::allocated_objs());
+}
+
+PERF_TEST_F(QSBRReclamationTest, ReadPerf) {
+  static std::atomic<TraceableObj*> ptr{nullptr};
+  this->recl_.ReadLock(&ptr);
+  this->recl_.ReadUnlock();
+}
@@ -0,0 +1,236 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <vector>
+#include "gtestx/gtestx.h"
+#include "ccbase/rate_limiter.h"
+#include "ccbase/token_bucket.h"
+
+TEST(GcraRateLimiterTest, SameRateAsTokenBucket) {
+  struct Case {
+    uint32_t rate;
+    uint32_t bucket_size;
+    uint32_t max_step_us;
+    uint32_t max_need;
+  };
+  // the high rate has an emission interval of 3.33 ns
+  for (const Case& c : {Case{1000, 50, 3000, 5},
+                        Case{300000000, 100000, 10, 5000}}) {
+    struct timeval tv = {100, 0};
+    ccb::GcraRateLimiter gcra(c.rate, c.bucket_size);
+    ccb::TokenBucket tb(c.rate, c.bucket_size, c.bucket_size, &tv);
+    uint64_t gcra_got = 0, tb_got = 0;
+    srand(1);
+    for (int i = 0; i < 10000; i++) {
+      uint64_t us = tv.tv_usec + rand() % c.max_step_us;
+      tv.tv_sec += us / 1000000;
+      tv.tv_usec = us % 1000000;
+      gcra.Gen(&tv);
+      tb.Gen(&tv);
+      uint32_t need = rand() % c.max_need;
+      if (gcra.Get(need)) gcra_got += need;
+      if (tb.Get(need)) tb_got += need;
+    }
+    // demand exceeds the rate all the time
+    uint64_t us = (tv.tv_sec - 100) * 1000000 + tv.tv_usec;
+    uint64_t expected = c.rate * us / 1000000;
+    ASSERT_GE(c.bucket_size + expected + 1, gcra_got) << c.rate;
+    ASSERT_LE(expected * 99 / 100, gcra_got) << c.rate;
+    // token bucket carries a fraction of token when it is full
+    ASSERT_LE(tb_got, gcra_got + c.bucket_size) << c.rate;
+    ASSERT_LE(gcra_got, tb_got + c.bucket_size) << c.rate;
+  }
+}
+
+TEST(GcraRateLimiterTest, OverdraftDebt) {
+  struct timeval tv = {100, 0};
+  ccb::GcraRateLimiter gcra(10, 5);
+  gcra.Gen(&tv);
+  ASSERT_EQ(15, gcra.Overdraft(20));
+  ASSERT_EQ(0U, gcra.tokens());
+  // the debt is paid back at the rate
+  tv.tv_sec += 1;
+  gcra.Gen(&tv);
+  ASSERT_EQ(0U, gcra.tokens());
+  tv.tv_usec = 600000;
+  gcra.Gen(&tv);
+  ASSERT_EQ(1U, gcra.tokens());
+}
+
+TEST(GcraRateLimiterTest, Burst) {
+  struct timeval tv = {100, 0};
+  ccb::GcraRateLimiter gcra(10, 5);
+  gcra.Gen(&tv);
+  ASSERT_EQ(5U, gcra.tokens());
+  ASSERT_TRUE(gcra.Get(5));
+  ASSERT_FALSE(gcra.Get(1));
+  tv.tv_usec = 99999;
+  gcra.Gen(&tv);
+  ASSERT_FALSE(gcra.Check(1));
+  tv.tv_usec = 100000;
+  gcra.Gen(&tv);
+  ASSERT_TRUE(gcra.Get(1));
+  ASSERT_EQ(3, gcra.Overdraft(3));
+}
+
+TEST(GcraRateLimiterTest, SharedConfig) {
+  struct timeval tv = {100, 0};
+  ccb::GcraConfig config(10, 5);
+  uint64_t now = config.Now(&tv);
+  // each state is only a TAT, a new one has a full bucket
+  uint64_t tats[2] = {now, now};
+  ASSERT_TRUE(config.Get(&tats[0], now, 5));
+  ASSERT_FALSE(config.Check(tats[0], now, 1));
+  ASSERT_EQ(5U, config.tokens(tats[1], now));
+  ASSERT_TRUE(config.Get(&tats[1], now, 2));
+  tv.tv_usec = 100000;
+  now = config.Now(&tv);
+  ASSERT_EQ(1U, config.tokens(tats[0], now));
+  ASSERT_EQ(4U, config.tokens(tats[1], now));
+  ASSERT_FALSE(config.Get(&tats[0], now, 6));
+}
+
+TEST(GcraRateLimiterTest, TimeGoesBack) {
+  struct timeval tv = {100, 0};
+  ccb::GcraRateLimiter gcra(10, 5);
+  gcra.Gen(&tv);
+  ASSERT_TRUE(gcra.Get(5));
+  // what is left to wait is kept
+  tv.tv_sec = 50;
+  gcra.Gen(&tv);
+  ASSERT_FALSE(gcra.Get(1));
+  tv.tv_usec = 100000;
+  gcra.Gen(&tv);
+  ASSERT_EQ(1U, gcra.tokens());
+}
+
+TEST(SlidingWindowRateLimiterTest, Strict) {
+  struct timeval tv = {100, 0};
+  ccb::SlidingWindowRateLimiter swl(100, 60000, 60);
+  swl.Gen(&tv);
+  ASSERT_EQ(100U, swl.tokens());
+  ASSERT_TRUE(swl.Get(60));
+  tv.tv_sec += 30;
+  swl.Gen(&tv);
+  ASSERT_TRUE(swl.Get(40));
+  ASSERT_FALSE(swl.Check(1));
+  // the first 60 tokens are still in the window
+  tv.tv_sec += 29;
+  swl.Gen(&tv);
+  ASSERT_FALSE(swl.Get(1));
+  // and they are dropped one slot later than the window
+  tv.tv_sec += 1;
+  swl.Gen(&tv);
+  ASSERT_FALSE(swl.Get(1));
+  tv.tv_sec += 1;
+  swl.Gen(&tv);
+  ASSERT_EQ(60U, swl.tokens());
+  ASSERT_TRUE(swl.Get(60));
+  ASSERT_EQ(1, swl.Overdraft(1));
+  // all expired
+  tv.tv_sec += 3600;
+  swl.Gen(&tv);
+  ASSERT_EQ(100U, swl.tokens());
+}
+
+TEST(SlidingWindowRateLimiterTest, TimeGoesBack) {
+  struct timeval tv = {100, 0};
+  ccb::SlidingWindowRateLimiter swl(10, 10000, 10);
+  swl.Gen(&tv);
+  ASSERT_TRUE(swl.Get(6));
+  tv.tv_sec = 105;
+  swl.Gen(&tv);
+  ASSERT_TRUE(swl.Get(4));
+  // the tokens taken are kept, and expire as if 105 had been 50
+  tv.tv_sec = 50;
+  swl.Gen(&tv);
+  ASSERT_EQ(0U, swl.tokens());
+  ASSERT_FALSE(swl.Get(1));
+  tv.tv_sec = 55;
+  swl.Gen(&tv);
+  ASSERT_FALSE(swl.Get(1));
+  tv.tv_sec = 56;
+  swl.Gen(&tv);
+  ASSERT_EQ(6U, swl.tokens());
+  tv.tv_sec = 61;
+  swl.Gen(&tv);
+  ASSERT_EQ(10U, swl.tokens());
+}
+
+TEST(SlidingWindowRateLimiterTest, NeverExceedsLimit) {
+  constexpr uint32_t kLimit = 1000;
+  constexpr uint64_t kWindowUs = 1000000;
+  struct timeval tv = {100, 0};
+  ccb::SlidingWindowRateLimiter swl(kLimit, kWindowUs / 1000, 10);
+  std::vector<uint64_t> granted;
+  uint64_t now = 100 * 1000000UL;
+  srand(1);
+  for (int i = 0; i < 100000; i++) {
+    now += rand() % 200;
+    tv.tv_sec = now / 1000000;
+    tv.tv_usec = now % 1000000;
+    swl.Gen(&tv);
+    if (swl.Get(1)) {
+      granted.push_back(now);
+    }
+  }
+  ASSERT_LT(kLimit * 5, granted.size());
+  for (size_t i = kLimit; i < granted.size(); i++) {
+    ASSERT_LE(kWindowUs, granted[i] - granted[i - kLimit]) << i;
+  }
+}
+
+TEST(SlidingWindowRateLimiterTest, UnevenSlots) {
+  // 1 ms in slots of 33.3 ns, rounding down would lose 10 us of the window
+  constexpr uint64_t kWindowUs = 1000;
+  struct timeval tv = {100, 0};
+  ccb::SlidingWindowRateLimiter swl(1, kWindowUs / 1000, 30000);
+  std::vector<uint64_t> granted;
+  for (uint64_t now = 100 * 1000000UL; now < 100 * 1000000UL + 100000;
+       now++) {
+    tv.tv_sec = now / 1000000;
+    tv.tv_usec = now % 1000000;
+    swl.Gen(&tv);
+    if (swl.Get(1)) {
+      granted.push_back(now);
+    }
+  }
+  ASSERT_LT(50U, granted.size());
+  for (size_t i = 1; i < granted.size(); i++) {
+    ASSERT_LE(kWindowUs, granted[i] - granted[i - 1]) << i;
+  }
+}
+
+PERF_TEST(GcraRateLimiterPerf, GenGet) {
+  static ccb::GcraRateLimiter gcra(1000000000, 1000000000,
+                                   ccb::ClockSource::kTsc);
+  gcra.Gen();
+  gcra.Get(1);
+}
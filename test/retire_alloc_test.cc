@@ -0,0 +1,93 @@
+/* Copyright (c) 2016-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include "gtestx/gtestx.h"
+#include "ccbase/memory_reclamation.h"
+
+// Replacing the global operator new affects the whole program, so this test
+// is built as a standalone binary
+
+// count heap allocations made by the calling thread
+static thread_local size_t tls_alloc_count = 0;
+
+void* operator new(size_t sz) {
+  tls_alloc_count++;
+  void* ptr = malloc(sz ? sz : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+struct RetiredObj {
+  int val;
+};
+
+struct AllocScope {};
+
+template <class RType>
+class RetireAllocTest : public testing::Test {
+ protected:
+  void TearDown() {
+    RType::RetireCleanup();
+  }
+};
+using RetireAllocTestTypes = testing::Types<
+    ccb::EpochBasedReclamation<RetiredObj, AllocScope>,
+    ccb::HazardPtrReclamation<RetiredObj, AllocScope>,
+    ccb::QSBRReclamation<RetiredObj, AllocScope>>;
+TYPED_TEST_CASE(RetireAllocTest, RetireAllocTestTypes);
+
+TYPED_TEST(RetireAllocTest, NoAllocPerRetire) {
+  std::atomic<size_t> deleted{0};
+  auto deleter = [&deleted](RetiredObj* p) {
+    deleted++;
+    delete p;
+  };
+  // warm up the chunk pool
+  for (int i = 0; i < 1000; i++) {
+    TypeParam::Retire(new RetiredObj, deleter);
+  }
+  size_t alloc_count = tls_alloc_count;
+  for (int i = 0; i < 10000; i++) {
+    TypeParam::Retire(new RetiredObj, deleter);
+    TypeParam::Retire(new RetiredObj);
+  }
+  // nothing is allocated except the objects
+  ASSERT_EQ(20000, tls_alloc_count - alloc_count);
+  TypeParam::RetireCleanup();
+  ASSERT_EQ(11000, deleted.load());
+}
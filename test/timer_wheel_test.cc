@@ -28,8 +28,10 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <stdio.h>
+#include <algorithm>
 #include <atomic>
 #include <thread>
+#include <vector>
 #include "gtestx/gtestx.h"
 #include "ccbase/timer_wheel.h"
 
@@ -206,6 +208,33 @@ TEST_F(TimerWheelTest, Period) {
   }
 }
 
+TEST_F(TimerWheelTest, PeriodReplaceInCallback) {
+  // the running callback of a period timer is replaced or freed by itself
+  int check = 0;
+  ccb::TimerOwner owner;
+  auto* deleted = new ccb::TimerOwner;
+  tw_.AddPeriodTimer(5, [this, &check, &owner] {
+    check++;
+    tw_.AddPeriodTimer(5, [&check] {
+      check += 100;
+    }, &owner);
+    check++;
+  }, &owner);
+  tw_.AddPeriodTimer(5, [&check, &deleted] {
+    delete deleted;
+    deleted = nullptr;
+    check += 10;
+  }, deleted);
+  usleep(6000);
+  tw_.MoveOn();
+  ASSERT_EQ(12, check);
+  ASSERT_EQ(nullptr, deleted);
+  ASSERT_EQ(1UL, tw_.GetTimerCount());
+  usleep(6000);
+  tw_.MoveOn();
+  ASSERT_LE(112, check);
+}
+
 TEST_F(TimerWheelTest, GetCurrentTick) {
   ccb::tick_t init_tick = tw_.GetCurrentTick();
   ccb::tick_t last_tick = init_tick;
@@ -234,6 +263,258 @@ TEST_F(TimerWheelTest, DeleteNodeTrackingTest) {
   ASSERT_EQ(1, check);
 }
 
+TEST_F(TimerWheelTest, CancelPeriodRefiredByOtherThread) {
+  // a period timer fired by this thread is fired again by another thread
+  // before a previous callback of this thread cancels it
+  std::thread::id this_thread = std::this_thread::get_id();
+  int fired_here = 0;
+  std::atomic<int> fired_there{0};
+  ccb::TimerOwner* owner = new ccb::TimerOwner;
+  tw_.AddTimer(2, [this, owner] {
+    usleep(3000);
+    std::thread([this] {
+      tw_.MoveOn();
+    }).join();
+    delete owner;
+  });
+  tw_.AddPeriodTimer(2, [&] {
+    if (std::this_thread::get_id() == this_thread) {
+      fired_here++;
+    } else {
+      fired_there++;
+    }
+  }, owner);
+  // fire sequences of the two threads differ
+  tw_.MoveOn();
+  usleep(3000);
+  tw_.MoveOn();
+  ASSERT_LT(0, fired_there.load());
+  ASSERT_EQ(0, fired_here);
+  ASSERT_EQ(0UL, tw_.GetTimerCount());
+}
+
+TEST_F(TimerWheelTest, MassCancelInCallbacks) {
+  // each fired timer cancels the one fired right after it
+  constexpr size_t kTimers = 10000;
+  std::vector<ccb::TimerOwner> owners(kTimers);
+  size_t fired = 0;
+  for (size_t i = 0; i < kTimers; i++) {
+    tw_.AddTimer(0, [&owners, &fired, i] {
+      fired++;
+      if (i + 1 < kTimers) {
+        owners[i + 1].Cancel();
+      }
+    }, &owners[i]);
+  }
+  tw_.MoveOn();
+  ASSERT_EQ(kTimers / 2, fired);
+  ASSERT_EQ(0UL, tw_.GetTimerCount());
+  // small rounds after the burst still track cancelled nodes
+  fired = 0;
+  for (size_t i = 0; i < 4; i++) {
+    tw_.AddTimer(0, [&owners, &fired, i] {
+      fired++;
+      owners[i + 1].Cancel();
+    }, &owners[i]);
+  }
+  tw_.MoveOn();
+  ASSERT_EQ(2UL, fired);
+  ASSERT_EQ(0UL, tw_.GetTimerCount());
+}
+
+TEST_F(TimerWheelTest, NextExpiryTicks) {
+  ASSERT_EQ(ccb::TimerWheel::kNoTimer, tw_.NextExpiryTicks());
+  ccb::TimerOwner to;
+  for (ccb::tick_t timeout : {0UL, 1UL, 100UL, 255UL, 256UL, 1000UL,
+                              20000UL, 3000000UL}) {
+    tw_.AddTimer(timeout, []{}, &to);
+    ccb::tick_t next = tw_.NextExpiryTicks();
+    ASSERT_LE(next, timeout);
+    if (timeout < 256) {
+      ASSERT_EQ(timeout, next);
+    } else {
+      // bound by the cascade, the error is less than the slot span
+      ccb::tick_t span = 256;
+      while (timeout >= span * 64) span *= 64;
+      ASSERT_GT(next + span, timeout);
+    }
+  }
+  to.Cancel();
+  ASSERT_EQ(ccb::TimerWheel::kNoTimer, tw_.NextExpiryTicks());
+  tw_.AddPeriodTimer(5, []{});
+  ASSERT_EQ(5UL, tw_.NextExpiryTicks());
+}
+
+TEST(TimerWheelNextExpiryTest, CascadeBeforeRootSlot) {
+  ccb::TimerWheel tw;
+  // a timer still in tv2 when a later timer is added to the far end of tv1
+  ccb::tick_t start = tw.GetCurrentTick();
+  ccb::tick_t cascade = (start / 256 + 2) * 256;
+  ccb::tick_t fire = cascade + 10;
+  tw.AddTimer(fire - start, []{});
+  while (tw.GetCurrentTick() + 200 < cascade) {
+    usleep(1000);
+    tw.MoveOn();
+  }
+  ccb::tick_t tick = tw.GetCurrentTick();
+  ASSERT_GE(cascade, tick);
+  tw.AddTimer(255, []{});
+  ccb::tick_t next = tw.NextExpiryTicks();
+  ASSERT_LE(next, fire - tick);
+  ASSERT_GE(next, cascade - tick);
+}
+
+TEST(TimerWheelNextExpiryTest, ConcurrentOwners) {
+  constexpr int kThreads = 4;
+  constexpr int kTimers = 100;
+  ccb::TimerWheel tw;
+  ccb::TimerOwner owners[kThreads][kTimers];
+  std::atomic<ccb::tick_t> min_fire{ccb::TimerWheel::kNoTimer};
+  std::atomic<bool> stop{false};
+  // lower bound is checked while owners are adding and resetting timers
+  std::thread checker([&] {
+    while (!stop.load()) {
+      ccb::tick_t next = tw.NextExpiryTicks();
+      ASSERT_TRUE(next == ccb::TimerWheel::kNoTimer || next < 70000);
+    }
+  });
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kTimers; i++) {
+        ccb::tick_t timeout = 100 + (t * kTimers + i) * 157 % 60000;
+        tw.AddTimer(timeout, []{}, &owners[t][i]);
+        if (i % 2) tw.ResetTimer(owners[t][i], timeout + 1);
+        // no MoveOn is running, so the current tick is fixed
+        ccb::tick_t fire = tw.GetCurrentTick() + timeout + (i % 2);
+        ccb::tick_t cur = min_fire.load();
+        while (fire < cur && !min_fire.compare_exchange_weak(cur, fire)) {}
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  stop = true;
+  checker.join();
+  ASSERT_EQ(static_cast<size_t>(kThreads * kTimers), tw.GetTimerCount());
+  ccb::tick_t next = tw.NextExpiryTicks();
+  ASSERT_LE(next, min_fire.load() - tw.GetCurrentTick());
+  for (auto& row : owners) {
+    for (auto& owner : row) {
+      owner.Cancel();
+    }
+  }
+  ASSERT_EQ(ccb::TimerWheel::kNoTimer, tw.NextExpiryTicks());
+}
+
+TEST_F(TimerWheelTest, InlineCallback) {
+  auto incr = [](void* arg) {
+    (*static_cast<int*>(arg))++;
+  };
+  int oneshot = 0, period = 0, cancelled = 0;
+  ccb::TimerOwner owner;
+  tw_.AddTimer(1, incr, &oneshot);
+  tw_.AddPeriodTimer(1, incr, &period);
+  tw_.AddTimer(1, incr, &cancelled, &owner);
+  owner.Cancel();
+  usleep(5000);
+  tw_.MoveOn();
+  ASSERT_EQ(1, oneshot);
+  ASSERT_LE(1, period);
+  ASSERT_EQ(0, cancelled);
+  int last_period = period;
+  usleep(2000);
+  tw_.MoveOn([](ccb::ClosureFunc<void()> cb) {
+    cb();
+  });
+  ASSERT_EQ(1, oneshot);
+  ASSERT_LT(last_period, period);
+}
+
+TEST(TimerWheelSkipTest, SkipEmptyTicks) {
+  // 1us per tick makes the wheel walk through large empty spans
+  ccb::TimerWheel tw(1, false);
+  std::vector<ccb::tick_t> fired;
+  std::vector<ccb::tick_t> timeouts = {1, 255, 256, 5000, 16384, 70000, 150000};
+  ccb::tick_t start = tw.GetCurrentTick();
+  for (ccb::tick_t timeout : timeouts) {
+    tw.AddTimer(timeout, [&tw, &fired, start, timeout] {
+      ASSERT_GE(tw.GetCurrentTick() - start, timeout);
+      fired.push_back(timeout);
+    });
+  }
+  while (fired.size() < timeouts.size()) {
+    usleep(1000);
+    tw.MoveOn();
+  }
+  ASSERT_EQ(timeouts, fired);
+  ASSERT_EQ(0UL, tw.GetTimerCount());
+}
+
+TEST(TimerWheelSlackTest, Coalesce) {
+  // 100us per tick
+  ccb::TimerWheel tw(100, false);
+  constexpr ccb::tick_t kTimeout = 100;
+  constexpr ccb::tick_t kSlack = 50;
+  std::vector<ccb::tick_t> fire_ticks;
+  ccb::tick_t start = tw.GetCurrentTick();
+  // callbacks run after MoveOn() has polled ticks [poll_from, current)
+  ccb::tick_t poll_from = start;
+  for (ccb::tick_t i = 0; i < 100; i++) {
+    ccb::tick_t expire = start + kTimeout + i;
+    tw.AddTimer(kTimeout + i, [&tw, &fire_ticks, &poll_from, expire] {
+      ccb::tick_t poll_to = tw.GetCurrentTick();
+      // never early and never later than the slack
+      EXPECT_LT(expire, poll_to);
+      EXPECT_GE(expire + kSlack, poll_from);
+      fire_ticks.push_back(poll_to);
+    }, nullptr, kSlack);
+  }
+  while (fire_ticks.size() < 100) {
+    usleep(1000);
+    poll_from = tw.GetCurrentTick();
+    tw.MoveOn();
+  }
+  // timeouts of 100 different ticks are merged into a few expirations
+  fire_ticks.erase(std::unique(fire_ticks.begin(), fire_ticks.end()),
+                   fire_ticks.end());
+  ASSERT_GE(6UL, fire_ticks.size());
+  ASSERT_FALSE(tw.AddTimer(0xffffffffUL, []{}, nullptr, 1));
+}
+
+TEST(TimerWheelClockTest, ClockSources) {
+  for (auto source : {ccb::ClockSource::kMonotonic,
+                      ccb::ClockSource::kMonotonicCoarse,
+                      ccb::ClockSource::kTsc}) {
+    // 100us per tick
+    ccb::TimerWheel tw(100, false, source);
+    bool fired = false;
+    tw.AddTimer(100, [&fired] {
+      fired = true;
+    });
+    usleep(5000);
+    tw.MoveOn();
+    ASSERT_FALSE(fired);
+    usleep(10000);
+    tw.MoveOn();
+    ASSERT_TRUE(fired);
+  }
+}
+
+PERF_TEST(TimerWheelClockPerf, TscMoveOn) {
+  static ccb::TimerWheel tw(1, false, ccb::ClockSource::kTsc);
+  tw.MoveOn();
+}
+
+PERF_TEST_F(TimerWheelTest, NextExpiryTicksPerf) {
+  static ccb::TimerOwner owner;
+  if (!owner.has_timer()) {
+    tw_.AddTimer(60000, []{}, &owner);
+  }
+  tw_.NextExpiryTicks();
+}
+
 PERF_TEST_F(TimerWheelTest, AddTimerPerf) {
   timers_++;
   tw_.AddTimer(1, [this]{
@@ -247,6 +528,16 @@ PERF_TEST_F(TimerWheelTest, AddTimerPerf) {
   }
 }
 
+PERF_TEST_F(TimerWheelTest, AddInlineTimerPerf) {
+  timers_++;
+  tw_.AddTimer(1, [](void* arg) {
+    (*static_cast<int*>(arg))--;
+  }, &timers_);
+  if ((count_ & 0x3ff) == 0) {
+    tw_.MoveOn();
+  }
+}
+
 PERF_TEST_F(TimerWheelTest, ResetTimerPerf) {
   static ccb::TimerOwner owner;
   if (!owner.has_timer()) {
@@ -255,6 +546,34 @@ PERF_TEST_F(TimerWheelTest, ResetTimerPerf) {
   tw_.ResetTimer(owner, 1);
 }
 
+PERF_TEST_F(TimerWheelTest, PeriodTimerFirePerf) {
+  static bool init = false;
+  if (!init) {
+    for (int i = 0; i < 1000; i++) {
+      tw_.AddPeriodTimer(10, [this] {
+        timers_++;
+      });
+    }
+    init = true;
+  }
+  tw_.MoveOn();
+}
+
+PERF_TEST_F(TimerWheelTest, MassCancelInCallbacksPerf) {
+  // a burst of cancels first, then rounds with a few cancels each
+  static std::vector<ccb::TimerOwner> owners(100000);
+  static size_t round = 0;
+  size_t timers = (round++ == 0 ? owners.size() : 16);
+  for (size_t i = 0; i < timers; i++) {
+    tw_.AddTimer(0, [i] {
+      if (i + 1 < owners.size()) {
+        owners[i + 1].Cancel();
+      }
+    }, &owners[i]);
+  }
+  tw_.MoveOn();
+}
+
 class TimerWheelNoLockTest : public testing::Test {
  protected:
   TimerWheelNoLockTest() {
@@ -268,6 +587,59 @@ class TimerWheelNoLockTest : public testing::Test {
   size_t count_ = 0;
 };
 
+TEST_F(TimerWheelNoLockTest, PostTimer) {
+  constexpr int kThreads = 4;
+  constexpr int kTimersPerThread = 1000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; i++) {
+    threads.emplace_back([this] {
+      for (int n = 0; n < kTimersPerThread; n++) {
+        tw_.PostTimer(n % 3, [this] {
+          timers_++;
+        });
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  ASSERT_TRUE(tw_.HasPostedTimers());
+  ASSERT_EQ(0UL, tw_.NextExpiryTicks());
+  int period = 0;
+  tw_.PostPeriodTimer(1, [&period] {
+    period++;
+  });
+  while (timers_ < kThreads * kTimersPerThread || period < 2) {
+    usleep(1000);
+    tw_.MoveOn();
+  }
+  ASSERT_EQ(kThreads * kTimersPerThread, timers_);
+  ASSERT_FALSE(tw_.HasPostedTimers());
+  ASSERT_EQ(1UL, tw_.GetTimerCount());
+}
+
+TEST_F(TimerWheelNoLockTest, PostMaxTimeout) {
+  // the wheel is behind the clock when the timer is posted
+  usleep(5000);
+  ASSERT_TRUE(tw_.PostTimer(0xffffffffUL, [this] {
+    timers_++;
+  }));
+  ASSERT_FALSE(tw_.PostTimer(0x100000000UL, [] {}));
+  tw_.MoveOn();
+  ASSERT_FALSE(tw_.HasPostedTimers());
+  ASSERT_EQ(1UL, tw_.GetTimerCount());
+  ASSERT_EQ(0, timers_);
+}
+
+PERF_TEST_F(TimerWheelNoLockTest, PostTimerPerf) {
+  tw_.PostTimer(1, [this] {
+    timers_--;
+  });
+  if ((++count_ & 0x3ff) == 0) {
+    tw_.MoveOn();
+  }
+}
+
 PERF_TEST_F(TimerWheelNoLockTest, AddTimerPerf) {
   timers_++;
   tw_.AddTimer(1, [this]{
@@ -348,3 +720,72 @@ PERF_TEST_F(TimerWheelMTTest, AddTimerPerf) {
   }
 }
 
+class ShardedTimerWheelMTTest : public testing::Test {
+ protected:
+  void SetUp() {
+    thread_ = std::thread([this] {
+      while (!stop_) {
+        tw_.MoveOn();
+        usleep(200);
+      }
+    });
+  }
+  void TearDown() {
+    stop_ = true;
+    thread_.join();
+  }
+  ccb::ShardedTimerWheel tw_{4};
+  std::thread thread_;
+  size_t count_ = 0;
+  std::atomic<int> timers_ = {0};
+  std::atomic<bool> stop_ = {false};
+};
+
+TEST_F(ShardedTimerWheelMTTest, Owner) {
+  std::atomic<int> check{0};
+  std::vector<ccb::TimerOwner> owners(16);
+  for (auto& owner : owners) {
+    tw_.AddTimer(10, [&check] {
+      check++;
+    }, &owner);
+  }
+  tw_.AddTimer(10, [&check] {
+    check++;
+  });
+  EXPECT_EQ(17UL, tw_.GetTimerCount());
+  EXPECT_GE(10UL, tw_.NextExpiryTicks());
+  owners[0].Cancel();
+  tw_.ResetTimer(owners[1], 100);
+  usleep(50000);
+  ASSERT_EQ(15, check);
+  usleep(100000);
+  ASSERT_EQ(16, check);
+  ASSERT_EQ(0UL, tw_.GetTimerCount());
+}
+
+TEST_F(ShardedTimerWheelMTTest, InlineAndPosted) {
+  std::atomic<int> check{0};
+  ccb::TimerOwner owner;
+  auto func = [](void* arg) {
+    (*static_cast<std::atomic<int>*>(arg))++;
+  };
+  tw_.AddTimer(10, func, &check, &owner);
+  tw_.AddTimer(10, func, &check);
+  tw_.PostTimer(10, [&check] {
+    check++;
+  });
+  usleep(100000);
+  ASSERT_EQ(3, check);
+  ASSERT_EQ(0UL, tw_.GetTimerCount());
+}
+
+PERF_TEST_F(ShardedTimerWheelMTTest, AddTimerPerf) {
+  timers_++;
+  bool res = tw_.AddTimer(1, [this]{
+    timers_--;
+  });
+  ASSERT_TRUE(res) << PERF_ABORT;
+  if ((++count_ & 0x3fffff) == 1) {
+    fprintf(stderr, "pending %d timers\n", static_cast<int>(timers_));
+  }
+}
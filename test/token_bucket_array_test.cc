@@ -0,0 +1,113 @@
+/* Copyright (c) 2012-2017, Bin Wei <bin@vip.qq.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *     * The names of its contributors may not be used to endorse or 
+ * promote products derived from this software without specific prior 
+ * written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <memory>
+#include <vector>
+#include "gtestx/gtestx.h"
+#include "ccbase/token_bucket.h"
+#include "ccbase/token_bucket_array.h"
+
+TEST(TokenBucketArrayTest, SameAsTokenBucket) {
+  constexpr size_t kBuckets = 1003;
+  ccb::TokenBucketArray simd_array;
+  ccb::TokenBucketArray scalar_array(ccb::ClockSource::kMonotonic, false);
+  ASSERT_FALSE(scalar_array.simd_enabled());
+  std::vector<std::unique_ptr<ccb::TokenBucket>> buckets;
+  struct timeval tv = {0, 0};
+  // the first Gen() sets the time base as it is behind the clock
+  simd_array.Gen(&tv);
+  scalar_array.Gen(&tv);
+  srand(1);
+  for (size_t i = 0; i < kBuckets; i++) {
+    uint32_t rate = (i % 7 == 0 ? UINT32_MAX - rand() % 100 :
+                     static_cast<uint32_t>(rand()) % 1000000);
+    uint32_t size = static_cast<uint32_t>(rand()) % 100000 + 1;
+    uint32_t init = static_cast<uint32_t>(rand()) % size;
+    ASSERT_EQ(i, simd_array.Add(rate, size, init));
+    ASSERT_EQ(i, scalar_array.Add(rate, size, init));
+    buckets.emplace_back(new ccb::TokenBucket(rate, size, init, &tv));
+  }
+  for (int round = 0; round < 1000; round++) {
+    uint64_t us = (round % 100 == 0 ? 3000000 + rand() % 1000000 :
+                   rand() % 10000);
+    us += tv.tv_usec;
+    tv.tv_sec += us / 1000000;
+    tv.tv_usec = us % 1000000;
+    simd_array.Gen(&tv);
+    scalar_array.Gen(&tv);
+    for (size_t i = 0; i < kBuckets; i++) {
+      buckets[i]->Gen(&tv);
+      ASSERT_EQ(buckets[i]->tokens(), simd_array.tokens(i)) << round << i;
+      ASSERT_EQ(buckets[i]->tokens(), scalar_array.tokens(i)) << round << i;
+      uint32_t need = rand() % 1000;
+      if (i % 3 == 0) {
+        ASSERT_EQ(buckets[i]->Overdraft(need),
+                  simd_array.Overdraft(i, need));
+        scalar_array.Overdraft(i, need);
+      } else {
+        bool res = buckets[i]->Get(need);
+        ASSERT_EQ(res, simd_array.Get(i, need));
+        ASSERT_EQ(res, scalar_array.Get(i, need));
+      }
+    }
+  }
+}
+
+TEST(TokenBucketArrayTest, ModZeroBucketSize) {
+  ccb::TokenBucketArray array;
+  struct timeval tv = {0, 0};
+  array.Gen(&tv);
+  size_t index = array.Add(1000, 10, 0);
+  // a zero bucket size is taken as 1 like Add()
+  array.Mod(index, 1000, 0);
+  tv.tv_sec = 1;
+  array.Gen(&tv);
+  ASSERT_EQ(1U, array.tokens(index));
+}
+
+PERF_TEST(TokenBucketArrayPerf, RefillSweepSimd) {
+  static ccb::TokenBucketArray array(ccb::ClockSource::kMonotonic, true);
+  if (array.size() == 0) {
+    for (size_t i = 0; i < 10000; i++) {
+      array.Add(1000 + i, 100000, 0);
+    }
+  }
+  array.Gen();
+}
+
+PERF_TEST(TokenBucketArrayPerf, RefillSweepScalar) {
+  static ccb::TokenBucketArray array(ccb::ClockSource::kMonotonic, false);
+  if (array.size() == 0) {
+    for (size_t i = 0; i < 10000; i++) {
+      array.Add(1000 + i, 100000, 0);
+    }
+  }
+  array.Gen();
+}
@@ -65,3 +65,64 @@ PERF_TEST_F(TokenBucket, Get_Perf) {
   if (!tb_.Get(1)) tb_.Mod(10000, 10000);
 }
 
+TEST(TokenBucketTimeUntil, Exact) {
+  struct timeval tv = {100, 0};
+  ccb::TokenBucket tb(3, 10, 0, &tv);
+  ASSERT_EQ(0UL, tb.TimeUntil(0, &tv));
+  ASSERT_EQ(UINT64_MAX, tb.TimeUntil(11, &tv));
+  uint64_t us = tb.TimeUntil(2, &tv);
+  ASSERT_EQ(666667UL, us);
+  struct timeval tv_ready = {100, static_cast<suseconds_t>(us)};
+  struct timeval tv_early = {100, static_cast<suseconds_t>(us - 1)};
+  ccb::TokenBucket tb_early(tb);
+  tb_early.Gen(&tv_early);
+  ASSERT_FALSE(tb_early.Check(2));
+  tb.Gen(&tv_ready);
+  ASSERT_TRUE(tb.Check(2));
+  ASSERT_EQ(0UL, tb.TimeUntil(2, &tv_ready));
+  // the carried fraction is taken into account
+  ASSERT_TRUE(tb.Get(2));
+  ASSERT_EQ(333333UL, tb.TimeUntil(1, &tv_ready));
+}
+
+TEST(TokenBucketClock, Monotonic) {
+  for (auto source : {ccb::ClockSource::kMonotonic,
+                      ccb::ClockSource::kMonotonicCoarse,
+                      ccb::ClockSource::kTsc}) {
+    ccb::TokenBucket tb(1000, 100, 0, source);
+    usleep(50000);
+    tb.Gen();
+    // coarse clock has jiffy precision
+    ASSERT_LE(40U, tb.tokens());
+    ASSERT_GE(100U, tb.tokens());
+    ASSERT_LT(0UL, tb.TimeUntil(100));
+  }
+}
+
+TEST(TokenBucketClock, GenInterval) {
+  struct timeval tv = {100, 0};
+  ccb::TokenBucket tb(1000, 100, 0, ccb::ClockSource::kMonotonic, 10000);
+  tb.Gen(&tv);
+  tv.tv_usec = 9999;
+  tb.Gen(&tv);
+  ASSERT_EQ(0U, tb.tokens());
+  ASSERT_EQ(1UL, tb.TimeUntil(1, &tv));
+  tv.tv_usec = 10500;
+  tb.Gen(&tv);
+  ASSERT_EQ(10U, tb.tokens());
+  tv.tv_usec = 20000;
+  tb.Gen(&tv);
+  ASSERT_EQ(10U, tb.tokens());
+  // the skipped time is not lost
+  tv.tv_usec = 20500;
+  tb.Gen(&tv);
+  ASSERT_EQ(20U, tb.tokens());
+}
+
+PERF_TEST(TokenBucketClockPerf, GenGet) {
+  static ccb::TokenBucket tb(1000000000, 1000000000, 0,
+                             ccb::ClockSource::kTsc, 1000);
+  tb.Gen();
+  tb.Get(1);
+}
+
@@ -27,9 +27,11 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <sched.h>
 #include <atomic>
 #include <thread>
 #include "gtestx/gtestx.h"
+#include "ccbase/concurrent_ptr.h"
 #include "ccbase/worker_group.h"
 #include "ccbase/token_bucket.h"
 
@@ -146,7 +148,46 @@ TEST_F(WorkerGroupTest, WorkerPoller) {
   });
   usleep(20000);
   ASSERT_NE(nullptr, poller1);
-  ASSERT_EQ(poller1, poller2);
+  ASSERT_NE(nullptr, poller2);
+  // default poller is created for each worker
+  ASSERT_NE(poller1, poller2);
+}
+
+TEST(WorkerGroupPlacementTest, CpuList) {
+  std::atomic_int cpu{-1};
+  {
+    ccb::WorkerGroup worker_group{2, QSIZE,
+                                  ccb::WorkerGroup::Placement::CpuList({0})};
+    worker_group.PostTask(1, [&cpu] {
+      cpu = sched_getcpu();
+    });
+    usleep(20000);
+  }
+  ASSERT_EQ(0, cpu);
+}
+
+TEST(WorkerGroupPlacementTest, BadCpuList) {
+  using Placement = ccb::WorkerGroup::Placement;
+  ASSERT_THROW(ccb::WorkerGroup(2, QSIZE, Placement::CpuList({0, 100000})),
+               std::invalid_argument);
+}
+
+TEST(WorkerGroupPlacementTest, Topology) {
+  using Placement = ccb::WorkerGroup::Placement;
+  ASSERT_FALSE(Placement::PhysicalCores().WorkerCpus(0).empty());
+  ASSERT_FALSE(Placement::NumaNodes().WorkerCpus(0).empty());
+  ASSERT_TRUE(Placement().WorkerCpus(0).empty());
+  std::atomic_int val{0};
+  {
+    ccb::WorkerGroup worker_group{4, QSIZE, Placement::NumaNodes()};
+    for (size_t i = 0; i < worker_group.size(); i++) {
+      worker_group.PostTask(i, [&val] {
+        val++;
+      });
+    }
+    usleep(20000);
+  }
+  ASSERT_EQ(4, val);
 }
 
 PERF_TEST_F_OPT(WorkerGroupTest, PostTaskPerf, DEFAULT_HZ, DEFAULT_TIME) {
@@ -168,3 +209,60 @@ TEST(WorkerGroupDtorTest, DestructBeforeThreadExit) {
   ccb::WorkerGroup worker_group{1, QSIZE};
   worker_group.PostTask([]{});
 }
+
+TEST(WorkerGroupQSBRTest, QuiescentBetweenTasks) {
+  using QSBR = ccb::QSBRReclamation<int, ccb::ConcurrentPtrScope<int>>;
+  ccb::ConcurrentPtr<int, std::default_delete<int>, QSBR> conc_ptr{new int(1)};
+  ccb::WorkerGroup workers{2, 1024};
+  std::atomic<int> sum{0};
+  for (int i = 0; i < 100; i++) {
+    workers.PostTask([&conc_ptr, &sum] {
+      decltype(conc_ptr)::Reader reader(&conc_ptr);
+      sum += *reader.get();
+    });
+    // the busy or sleeping workers never hold up the reclamation
+    conc_ptr.Reset(new int(1), true);
+  }
+  while (sum.load() < 100) {
+    usleep(1000);
+  }
+  conc_ptr.Reset(true);
+}
+
+class SleepPoller : public ccb::WorkerGroup::Poller {
+ public:
+  void Poll(size_t timeout_ms) override {
+    usleep(timeout_ms * 1000);
+  }
+};
+
+TEST(WorkerGroupQSBRTest, QuiescentWithoutWakeup) {
+  using QSBR = ccb::QSBRReclamation<int, ccb::ConcurrentPtrScope<int>>;
+  ccb::ConcurrentPtr<int, std::default_delete<int>, QSBR> conc_ptr{new int(1)};
+  ccb::WorkerGroup workers{1, 1024, [](size_t) {
+    return std::make_shared<SleepPoller>();
+  }};
+  std::atomic<int> sum{0};
+  workers.PostTask([&conc_ptr, &sum] {
+    decltype(conc_ptr)::Reader reader(&conc_ptr);
+    sum += *reader.get();
+  });
+  while (sum.load() < 1) {
+    usleep(1000);
+  }
+  // the idle worker polling without wakeup never holds up the reclamation
+  std::atomic<bool> reclaimed{false};
+  std::thread writer([&conc_ptr, &reclaimed] {
+    conc_ptr.Reset(new int(2), true);
+    reclaimed = true;
+  });
+  for (int i = 0; i < 100 && !reclaimed; i++) {
+    usleep(10000);
+  }
+  bool reclaimed_idle = reclaimed;
+  // a task unblocks the writer otherwise
+  workers.PostTask([] {});
+  writer.join();
+  ASSERT_TRUE(reclaimed_idle);
+  conc_ptr.Reset(true);
+}
@@ -30,6 +30,7 @@
 #include <atomic>
 #include <thread>
 #include "gtestx/gtestx.h"
+#include "ccbase/concurrent_ptr.h"
 #include "ccbase/worker_pool.h"
 
 #define QSIZE 100000
@@ -81,6 +82,56 @@ TEST_F(WorkerPoolTest, PostPeriodTask) {
   ASSERT_EQ(10, val);
 }
 
+TEST_F(WorkerPoolTest, DelayTaskBurst) {
+  // simultaneous expirations are spread over the workers
+  constexpr int kTasks = 10000;
+  ccb::WorkerPool worker_pool{4, 4, QSIZE};
+  std::atomic<uint32_t> worker_mask{0};
+  auto timer_wheel_add = [&] {
+    auto tw = ccb::WorkerPool::Worker::self()->timer_wheel();
+    for (int i = 0; i < kTasks; i++) {
+      tw->AddTimer(5, [&] {
+        val++;
+        worker_mask |= 1U << ccb::WorkerPool::Worker::self()->id();
+      });
+    }
+  };
+  worker_pool.PostTask(timer_wheel_add);
+  for (int i = 0; i < 100 && val < kTasks; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(kTasks, val);
+  ASSERT_LT(1, __builtin_popcount(worker_mask));
+}
+
+TEST_F(WorkerPoolTest, DelayTaskSlowInBatch) {
+  // a slow task holds up only the rest of its own small batch
+  constexpr int kTasks = 4000;
+  ccb::WorkerPool worker_pool{4, 4, QSIZE};
+  std::atomic<bool> slow{true};
+  auto timer_wheel_add = [&] {
+    auto tw = ccb::WorkerPool::Worker::self()->timer_wheel();
+    for (int i = 0; i < kTasks; i++) {
+      tw->AddTimer(5, [&, i] {
+        if (i == 0) {
+          while (slow) usleep(1000);
+        }
+        val++;
+      });
+    }
+  };
+  worker_pool.PostTask(timer_wheel_add);
+  for (int i = 0; i < 100 && val < kTasks - 32; i++) {
+    usleep(10000);
+  }
+  ASSERT_LE(kTasks - 32, val);
+  slow = false;
+  for (int i = 0; i < 100 && val < kTasks; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(kTasks, val);
+}
+
 TEST_F(WorkerPoolTest, WorkerSelf) {
   using Worker = ccb::WorkerPool::Worker;
   worker_pool_1_.PostTask([this] {
@@ -169,3 +220,22 @@ TEST(WorkerPoolDtorTest, DestructBeforeThreadExit) {
   ccb::WorkerPool worker_pool{2, 8, QSIZE};
   worker_pool.PostTask([]{});
 }
+
+TEST(WorkerPoolQSBRTest, QuiescentBetweenTasks) {
+  using QSBR = ccb::QSBRReclamation<int, ccb::ConcurrentPtrScope<int>>;
+  ccb::ConcurrentPtr<int, std::default_delete<int>, QSBR> conc_ptr{new int(1)};
+  ccb::WorkerPool workers{2, 2, 1024};
+  std::atomic<int> sum{0};
+  for (int i = 0; i < 100; i++) {
+    workers.PostTask([&conc_ptr, &sum] {
+      decltype(conc_ptr)::Reader reader(&conc_ptr);
+      sum += *reader.get();
+    });
+    // the busy or sleeping workers never hold up the reclamation
+    conc_ptr.Reset(new int(1), true);
+  }
+  while (sum.load() < 100) {
+    usleep(1000);
+  }
+  conc_ptr.Reset(true);
+}